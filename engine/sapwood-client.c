@@ -31,9 +31,24 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <gdk/gdk.h>
+
 #include "sapwood-client.h"
 #include "sapwood-proto.h"
 
+typedef struct
+{
+  SapwoodClientReplyFunc func;
+  gpointer               user_data;
+} PendingReply;
+
+/* the connection shared by all requests of the process */
+static int         client_fd      = -1;
+static guint32     client_seq     = 0;
+static GHashTable *client_pending = NULL; /* seq -> PendingReply */
+static GByteArray *client_buffer  = NULL; /* partially read replies */
+static guint       client_watch   = 0;
+
 GQuark
 sapwood_client_get_error_quark (void)
 {
@@ -81,3 +96,249 @@ sapwood_client_get_socket (GError **err)
   return fd;
 }
 
+
+static void
+client_disconnect (const GError *error)
+{
+  GHashTable     *pending = client_pending;
+  GHashTableIter  iter;
+  gpointer        value;
+
+  if (client_watch)
+    g_source_remove (client_watch);
+  client_watch = 0;
+
+  if (client_fd != -1)
+    close (client_fd);
+  client_fd = -1;
+
+  if (client_buffer)
+    g_byte_array_set_size (client_buffer, 0);
+
+  /* the callbacks may already start a new connection */
+  client_pending = NULL;
+  if (pending)
+    {
+      g_hash_table_iter_init (&iter, pending);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+	{
+	  PendingReply *reply = value;
+
+	  reply->func (NULL, 0, error, reply->user_data);
+	}
+      g_hash_table_destroy (pending);
+    }
+}
+
+/* reads whatever is available, returns FALSE if the connection is gone */
+static gboolean
+client_read (gboolean   block,
+             GError   **err)
+{
+  char    buf[4096];
+  ssize_t n;
+
+  do
+    n = recv (client_fd, buf, sizeof (buf), block ? 0 : MSG_DONTWAIT);
+  while (n < 0 && errno == EINTR);
+
+  if (n < 0 && !block && errno == EAGAIN)
+    return TRUE;
+
+  if (n < 0)
+    {
+      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		   "read: %s", g_strerror (errno));
+      return FALSE;
+    }
+  else if (n == 0)
+    {
+      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		   "connection closed by the sapwood server");
+      return FALSE;
+    }
+
+  g_byte_array_append (client_buffer, (guint8 *) buf, n);
+  return TRUE;
+}
+
+static void
+client_dispatch (void)
+{
+  while (client_buffer->len >= sizeof (PixbufBaseResponse))
+    {
+      PixbufBaseResponse *header = (PixbufBaseResponse *) client_buffer->data;
+      PendingReply       *pending = NULL;
+      guint32             seq = header->seq;
+      gsize               len = header->length;
+      char               *reply;
+
+      if (len < sizeof (PixbufBaseResponse))
+	{
+	  GError *error = NULL;
+
+	  g_set_error (&error, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		       "invalid reply length %zu", len);
+	  client_disconnect (error);
+	  g_error_free (error);
+	  return;
+	}
+
+      if (client_buffer->len < len)
+	break;
+
+      /* consume the reply first, the callback may read more */
+      len -= sizeof (PixbufBaseResponse);
+      reply = g_memdup (header + 1, len);
+      g_byte_array_remove_range (client_buffer, 0, len + sizeof (PixbufBaseResponse));
+
+      if (client_pending)
+	pending = g_hash_table_lookup (client_pending, GUINT_TO_POINTER (seq));
+
+      if (pending)
+	{
+	  g_hash_table_steal (client_pending, GUINT_TO_POINTER (seq));
+	  pending->func (reply, len, NULL, pending->user_data);
+	  g_free (pending);
+	}
+      else
+	g_warning ("unexpected reply for request %u", seq);
+
+      g_free (reply);
+
+      if (client_fd == -1)
+	break;
+    }
+}
+
+static gboolean
+client_watch_callback (GIOChannel   *channel,
+                       GIOCondition  cond,
+                       gpointer      user_data)
+{
+  GError   *error = NULL;
+  gboolean  retval = TRUE;
+
+  gdk_threads_enter ();
+
+  /* the replies may have been consumed by sapwood_client_wait() since the
+   * poll, so never block here */
+  if (client_read (FALSE, &error))
+    client_dispatch ();
+  else
+    {
+      client_watch = 0;
+      client_disconnect (error);
+      g_error_free (error);
+      retval = FALSE;
+    }
+
+  gdk_threads_leave ();
+
+  return retval;
+}
+
+static gboolean
+client_connect (GError **err)
+{
+  GIOChannel *channel;
+
+  if (client_fd != -1)
+    return TRUE;
+
+  client_fd = sapwood_client_get_socket (err);
+  if (client_fd == -1)
+    return FALSE;
+
+  if (!client_buffer)
+    client_buffer = g_byte_array_new ();
+  if (!client_pending)
+    client_pending = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  /* deliver the replies to asynchronous requests from the main loop */
+  channel = g_io_channel_unix_new (client_fd);
+  client_watch = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+				 client_watch_callback, NULL);
+  g_io_channel_unref (channel);
+
+  return TRUE;
+}
+
+/* Sends @req to the server without waiting for the reply. The reply will be
+ * passed to @func, either from the main loop or from sapwood_client_wait().
+ * Requests without a reply must pass %NULL for @func.
+ *
+ * Returns the sequence number of the request, or 0 on error.
+ */
+guint32
+sapwood_client_request (PixbufBaseRequest      *req,
+                        SapwoodClientReplyFunc  func,
+                        gpointer                user_data,
+                        GError                **err)
+{
+  GError  *error = NULL;
+  ssize_t  n;
+
+  if (!client_connect (err))
+    return 0;
+
+  /* 0 is never used, to allow it to mean 'no request' */
+  if (++client_seq == 0)
+    client_seq++;
+  req->seq = client_seq;
+
+  do
+    n = write (client_fd, req, req->length);
+  while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    g_set_error (&error, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		 "write: %s", g_strerror (errno));
+  else if (n != req->length)
+    g_set_error (&error, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		 "wrote %zd of %d bytes", n, req->length);
+
+  if (error)
+    {
+      /* the stream is out of sync now */
+      client_disconnect (error);
+      g_propagate_error (err, error);
+      return 0;
+    }
+
+  if (func)
+    {
+      PendingReply *pending = g_new (PendingReply, 1);
+
+      pending->func      = func;
+      pending->user_data = user_data;
+      g_hash_table_insert (client_pending, GUINT_TO_POINTER (req->seq), pending);
+    }
+
+  return req->seq;
+}
+
+/* Blocks until the reply to @seq has been passed to its callback. Replies
+ * to other requests arriving in the meantime are dispatched as well.
+ */
+gboolean
+sapwood_client_wait (guint32   seq,
+                     GError  **err)
+{
+  while (client_pending &&
+	 g_hash_table_lookup (client_pending, GUINT_TO_POINTER (seq)))
+    {
+      GError *error = NULL;
+
+      if (!client_read (TRUE, &error))
+	{
+	  client_disconnect (error);
+	  g_propagate_error (err, error);
+	  return FALSE;
+	}
+
+      client_dispatch ();
+    }
+
+  return TRUE;
+}
@@ -25,9 +25,17 @@
 #define SAPWOOD_CLIENT_H
 
 #include <glib.h>
+#include "sapwood-proto.h"
 
 G_BEGIN_DECLS
 
+/* @reply and @reply_len are the reply without the PixbufBaseResponse header,
+ * @error is set instead if the connection to the server was lost */
+typedef void (*SapwoodClientReplyFunc) (const char   *reply,
+                                        gsize         reply_len,
+                                        const GError *error,
+                                        gpointer      user_data);
+
 enum {
     SAPWOOD_CLIENT_ERROR_UNKNOWN
 };
@@ -38,6 +46,13 @@ G_GNUC_INTERNAL GQuark sapwood_client_get_error_quark (void);
 
 G_GNUC_INTERNAL int    sapwood_client_get_socket      (GError **err);
 
+G_GNUC_INTERNAL guint32  sapwood_client_request (PixbufBaseRequest      *req,
+                                                 SapwoodClientReplyFunc  func,
+                                                 gpointer                user_data,
+                                                 GError                **err);
+G_GNUC_INTERNAL gboolean sapwood_client_wait    (guint32                 seq,
+                                                 GError                **err);
+
 G_END_DECLS
 
 #endif /* !SAPWOOD_CLIENT_H */
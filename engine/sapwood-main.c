@@ -77,6 +77,11 @@ G_MODULE_EXPORT const gchar* g_module_check_init (GModule *module);
 const gchar*
 g_module_check_init (GModule *module)
 {
+  /* the connection to the server and the gtkrc cache leave sources in the
+   * main loop that call into the module, it must not be unloaded on theme
+   * changes */
+  g_module_make_resident (module);
+
   return gtk_check_version (GTK_MAJOR_VERSION,
 			    GTK_MINOR_VERSION,
 			    GTK_MICRO_VERSION - GTK_INTERFACE_AGE);
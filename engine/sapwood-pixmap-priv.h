@@ -30,8 +30,13 @@ struct _SapwoodPixmap {
   guint32    id;
   gint       width;
   gint       height;
+  gint       depth;
   GdkPixmap *pixmap[3][3];
   GdkBitmap *pixmask[3][3];
+  guint16    solid;             /* parts filled with color[][] instead */
+  guint32    color[3][3];
+  GdkRectangle src[3][3];       /* of the parts in an atlas */
+  gboolean   atlas;
 };
 
 #endif /* !SAPWOOD_PIXMAP_PRIV_H */
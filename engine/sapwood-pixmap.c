@@ -29,81 +29,27 @@
 #include <string.h>
 #include <unistd.h>
 
-static gboolean
-pixbuf_proto_request (const char *req,
-                      ssize_t     reqlen,
-                      char       *rep,
-                      ssize_t     replen,
-                      GError    **err)
+/* returns the request length or 0 if the filename does not fit */
+static gsize
+pixbuf_proto_marshal_open (PixbufOpenRequest *req,
+                           const char        *filename,
+                           int                border_left,
+                           int                border_right,
+                           int                border_top,
+                           int                border_bottom,
+                           int                depth,
+                           GError           **err)
 {
-  static int fd = -1;
-  ssize_t    n;
+  int flen;
 
-  if (fd == -1)
-    {
-      fd = sapwood_client_get_socket (err);
-      if (fd == -1)
-	return FALSE;
-    }
-
-  n = write (fd, req, reqlen);
-  if (n < 0)
-    {
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-		   "write: %s", g_strerror (errno));
-      return FALSE;
-    }
-  else if (n != reqlen)
-    {
-      /* FIXME */
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-                   "wrote %zd of %zd bytes", n, reqlen);
-      return FALSE;
-    }
-
-  if (!rep)
-    return TRUE;
-
-  n = read (fd, rep, replen);
-  if (n < 0)
-    {
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-		   "read: %s", g_strerror (errno));
-      return FALSE;
-    }
-  else if (n != replen)
-    {
-      /* FIXME */
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-                   "read %zd, expected %zd bytes", n, replen);
-      return FALSE;
-    }
-
-  return TRUE;
-}
-
-SapwoodPixmap *
-sapwood_pixmap_get_for_file (const char *filename,
-                             int         border_left,
-                             int         border_right,
-                             int         border_top,
-                             int         border_bottom,
-                             GError    **err)
-{
-  SapwoodPixmap     *self;
-  char               buf[ sizeof(PixbufOpenRequest) + PATH_MAX + 1 ] = {0};
-  PixbufOpenRequest *req = (PixbufOpenRequest *) buf;
-  PixbufOpenResponse rep;
-  int                flen;
-  int                i, j;
-
-  /* marshal request */
+  /* g_strlcpy() truncates to PATH_MAX - 1 bytes and returns the length of
+   * @filename */
   flen = g_strlcpy (req->filename, filename, PATH_MAX);
-  if (flen > PATH_MAX)
+  if (flen >= PATH_MAX)
     {
       g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
 		   "%s: filename too long", filename);
-      return NULL;
+      return 0;
     }
 
   req->base.op       = PIXBUF_OP_OPEN;
@@ -112,66 +58,107 @@ sapwood_pixmap_get_for_file (const char *filename,
   req->border_right  = border_right;
   req->border_top    = border_top;
   req->border_bottom = border_bottom;
+  req->depth         = depth;
 
-  if (!pixbuf_proto_request ((char*)req,  req->base.length,
-			     (char*)&rep, sizeof(rep), err))
-    return NULL;
+  return req->base.length;
+}
+
+/* Wraps a pixmap owned by the server. The geometry is known from the reply,
+ * so unlike gdk_pixmap_foreign_new() this does not need to query the X
+ * server, except when debugging X errors.
+ */
+static GdkPixmap *
+sapwood_pixmap_import (const char *filename,
+                       const char *what,
+                       int         i,
+                       int         j,
+                       guint32     xid,
+                       gint        width,
+                       gint        height,
+                       gint        depth)
+{
+  GdkScreen *screen = gdk_screen_get_default ();
+  GdkPixmap *pixmap;
+  int        xerror = 0;
+
+  pixmap = gdk_pixmap_lookup_for_display (gdk_screen_get_display (screen), xid);
+  if (pixmap)
+    return g_object_ref (pixmap);
+
+  if (sapwood_debug_xtraps)
+    {
+      gdk_error_trap_push ();
+      pixmap = gdk_pixmap_foreign_new_for_display (gdk_screen_get_display (screen), xid);
+      gdk_flush ();
+      xerror = gdk_error_trap_pop ();
+    }
+  else if (width > 0 && height > 0 && depth > 0)
+    pixmap = gdk_pixmap_foreign_new_for_screen (screen, xid, width, height, depth);
+
+  if (xerror || !pixmap)
+    {
+      gchar *basename = g_path_get_basename(filename);
+
+      g_warning ("%s: %s[%d][%d]: importing %x (%dx%dx%d) failed, X error = %d",
+		 basename, what, i, j, xid, width, height, depth, xerror);
+      g_free(basename);
+      if (pixmap)
+	g_object_unref (pixmap);
+      pixmap = NULL;
+    }
+
+  return pixmap;
+}
+
+static SapwoodPixmap *
+sapwood_pixmap_new_from_response (const char               *filename,
+                                  const PixbufOpenResponse *rep)
+{
+  SapwoodPixmap *self;
+  int            i, j;
 
-  /* unmarshal response */
   self = g_new0 (SapwoodPixmap, 1);
-  self->id     = rep.id;
-  self->width  = rep.width;
-  self->height = rep.height;
+  self->id     = rep->id;
+  self->width  = rep->width;
+  self->height = rep->height;
+  self->depth  = rep->depth;
+  self->solid  = rep->solid;
+  self->atlas  = rep->atlas_width != 0;
+  memcpy (self->color, rep->color, sizeof (self->color));
 
   for (i = 0; i < 3; i++)
     for (j = 0; j < 3; j++)
       {
 	GdkPixmap *pixmap  = NULL;
 	GdkBitmap *pixmask = NULL;
-	int xerror;
 
-	if (rep.pixmap[i][j])
-	  {
-	    gdk_error_trap_push ();
-	    pixmap = gdk_pixmap_foreign_new (rep.pixmap[i][j]);
-
-            if (sapwood_debug_xtraps)
-              gdk_flush ();
-
-	    if ((xerror = gdk_error_trap_pop ()) || !pixmap)
-	      {
-		gchar *basename = g_path_get_basename(filename);
-
-		g_warning ("%s: pixmap[%d][%d]: gdk_pixmap_foreign_new(%x) failed, X error = %d",
-			   basename, i, j, rep.pixmap[i][j], xerror);
-		g_free(basename);
-		if (pixmap)
-		  g_object_unref (pixmap);
-		pixmap = NULL;
-	      }
-	  }
+	gint       width   = rep->tile_width[i][j];
+	gint       height  = rep->tile_height[i][j];
 
-	if (rep.pixmask[i][j])
+	/* the parts of an atlas all share the same pixmap and mask */
+	if (self->atlas)
 	  {
-	    gdk_error_trap_push ();
-	    pixmask = gdk_pixmap_foreign_new (rep.pixmask[i][j]);
-
-            if (sapwood_debug_xtraps)
-              gdk_flush ();
-
-	    if ((xerror = gdk_error_trap_pop ()) || !pixmask)
-	      {
-		gchar *basename = g_path_get_basename(filename);
-
-		g_warning ("%s: pixmask[%d][%d]: gdk_pixmap_foreign_new(%x) failed, X error = %d", 
-			   basename, i, j, rep.pixmask[i][j], xerror);
-		g_free(basename);
-		if (pixmask)
-		  g_object_unref (pixmask);
-		pixmask = NULL;
-	      }
+	    self->src[i][j].x      = rep->tile_x[i][j];
+	    self->src[i][j].y      = rep->tile_y[i][j];
+	    self->src[i][j].width  = width;
+	    self->src[i][j].height = height;
+
+	    width  = rep->atlas_width;
+	    height = rep->atlas_height;
 	  }
 
+	if (rep->pixmap[i][j])
+	  pixmap = sapwood_pixmap_import (filename, "pixmap", i, j,
+					  rep->pixmap[i][j],
+					  width, height,
+					  rep->depth);
+
+	if (rep->pixmask[i][j])
+	  pixmask = sapwood_pixmap_import (filename, "pixmask", i, j,
+					   rep->pixmask[i][j],
+					   width, height,
+					   1);
+
 	if (pixmask && !pixmap)
 	  {
 	    gchar *basename = g_path_get_basename(filename);
@@ -187,6 +174,233 @@ sapwood_pixmap_get_for_file (const char *filename,
   return self;
 }
 
+typedef struct
+{
+  const char    *filename;
+  SapwoodPixmap *pixmap;
+  GError        *error;
+} OpenSync;
+
+static void
+open_sync_reply (const char   *reply,
+                 gsize         reply_len,
+                 const GError *error,
+                 gpointer      user_data)
+{
+  OpenSync *sync = user_data;
+
+  if (error)
+    sync->error = g_error_copy (error);
+  else if (reply_len != sizeof (PixbufOpenResponse))
+    g_set_error (&sync->error, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		 "%s: the sapwood server failed to open the image", sync->filename);
+  else
+    sync->pixmap = sapwood_pixmap_new_from_response (sync->filename,
+						     (const PixbufOpenResponse *) reply);
+}
+
+SapwoodPixmap *
+sapwood_pixmap_get_for_file (const char *filename,
+                             int         border_left,
+                             int         border_right,
+                             int         border_top,
+                             int         border_bottom,
+                             GError    **err)
+{
+  return sapwood_pixmap_get_for_file_at_depth (filename,
+                                               border_left, border_right,
+                                               border_top, border_bottom,
+                                               0, err);
+}
+
+/* the same image in pixmaps of @depth, for drawables with a depth other
+ * than the one of the screen (e.g. ARGB windows); 0 for the screen's */
+SapwoodPixmap *
+sapwood_pixmap_get_for_file_at_depth (const char *filename,
+                                      int         border_left,
+                                      int         border_right,
+                                      int         border_top,
+                                      int         border_bottom,
+                                      int         depth,
+                                      GError    **err)
+{
+  char               buf[ sizeof(PixbufOpenRequest) + PATH_MAX + 1 ] = {0};
+  PixbufOpenRequest *req = (PixbufOpenRequest *) buf;
+  OpenSync           sync = { filename, NULL, NULL };
+  guint32            seq;
+
+  /* marshal request */
+  if (!pixbuf_proto_marshal_open (req, filename,
+                                  border_left, border_right,
+                                  border_top, border_bottom,
+                                  depth, err))
+    return NULL;
+
+  seq = sapwood_client_request (&req->base, open_sync_reply, &sync, err);
+  if (!seq)
+    return NULL;
+
+  if (!sapwood_client_wait (seq, err))
+    {
+      if (sync.error)
+	g_error_free (sync.error);
+      return NULL;
+    }
+
+  if (sync.error)
+    g_propagate_error (err, sync.error);
+
+  return sync.pixmap;
+}
+
+typedef struct
+{
+  SapwoodPixmapFunc   func;
+  guint32             seq;
+  guint               n_requests;
+  char              **filenames;
+  gpointer           *user_data;
+} OpenBatch;
+
+static void
+open_batch_free (OpenBatch *batch)
+{
+  g_strfreev (batch->filenames);
+  g_free (batch->user_data);
+  g_free (batch);
+}
+
+static void
+open_batch_reply (const char   *reply,
+                  gsize         reply_len,
+                  const GError *error,
+                  gpointer      user_data)
+{
+  OpenBatch                *batch = user_data;
+  const PixbufOpenResponse *reps = (const PixbufOpenResponse *) reply;
+  guint                     i;
+
+  if (error)
+    reps = NULL;
+  else if (reply_len != batch->n_requests * sizeof (PixbufOpenResponse))
+    {
+      g_warning ("batch open: reply of %zu bytes for %u images",
+		 reply_len, batch->n_requests);
+      reps = NULL;
+    }
+
+  for (i = 0; i < batch->n_requests; i++)
+    {
+      SapwoodPixmap *pixmap = NULL;
+
+      if (reps && reps[i].id)
+	pixmap = sapwood_pixmap_new_from_response (batch->filenames[i], &reps[i]);
+
+      batch->func (pixmap, batch->seq, batch->user_data[i]);
+    }
+
+  open_batch_free (batch);
+}
+
+/* Starts opening the images of all @requests using as few requests to the
+ * server as possible, without waiting for the replies. @func is called once
+ * for every image from the main loop, or from sapwood_pixmap_wait(), with
+ * the sequence number that was stored in the request.
+ *
+ * Returns %FALSE if not all requests could be sent, the requests that were
+ * not sent have a sequence number of 0 and @func is not called for them.
+ */
+gboolean
+sapwood_pixmap_open_async (SapwoodPixmapRequest *requests,
+                           guint                 n_requests,
+                           SapwoodPixmapFunc     func,
+                           GError              **err)
+{
+  PixbufOpenBatchRequest *req;
+  char                   *buf;
+  guint                   first, n, i;
+  gsize                   len;
+  gboolean                retval = TRUE;
+
+  for (i = 0; i < n_requests; i++)
+    requests[i].seq = 0;
+
+  buf = g_malloc (G_MAXUINT16);
+
+  req = (PixbufOpenBatchRequest *) buf;
+  req->base.op = PIXBUF_OP_OPEN_BATCH;
+  req->_pad1   = 0;
+
+  for (first = 0; first < n_requests; first += n)
+    {
+      OpenBatch *batch;
+
+      len = sizeof (PixbufOpenBatchRequest);
+
+      /* pack as many requests as fit */
+      for (n = 0; first + n < n_requests && n < PIXBUF_OPEN_BATCH_MAX; n++)
+	{
+	  SapwoodPixmapRequest *r = &requests[first + n];
+	  char                  tmp[ PIXBUF_PROTO_ALIGN (sizeof(PixbufOpenRequest) + PATH_MAX) ];
+	  PixbufOpenRequest    *open = (PixbufOpenRequest *) tmp;
+	  gsize                 reqlen;
+
+	  reqlen = pixbuf_proto_marshal_open (open, r->filename,
+					      r->border_left, r->border_right,
+					      r->border_top, r->border_bottom,
+					      0, NULL);
+	  if (!reqlen)
+	    reqlen = pixbuf_proto_marshal_open (open, "", 0, 0, 0, 0, 0, NULL);
+
+	  if (len + PIXBUF_PROTO_ALIGN (reqlen) > G_MAXUINT16)
+	    break;
+
+	  open->base.length = PIXBUF_PROTO_ALIGN (reqlen);
+	  memset (tmp + reqlen, 0, open->base.length - reqlen);
+	  memcpy (buf + len, tmp, open->base.length);
+	  len += open->base.length;
+	}
+
+      req->base.length = len;
+      req->n_requests  = n;
+
+      batch = g_new (OpenBatch, 1);
+      batch->func       = func;
+      batch->n_requests = n;
+      batch->filenames  = g_new (char *, n + 1);
+      batch->user_data  = g_new (gpointer, n);
+      for (i = 0; i < n; i++)
+	{
+	  batch->filenames[i] = g_strdup (requests[first + i].filename);
+	  batch->user_data[i] = requests[first + i].user_data;
+	}
+      batch->filenames[n] = NULL;
+
+      batch->seq = sapwood_client_request (&req->base, open_batch_reply, batch, err);
+      if (!batch->seq)
+	{
+	  open_batch_free (batch);
+	  retval = FALSE;
+	  break;
+	}
+
+      for (i = 0; i < n; i++)
+	requests[first + i].seq = batch->seq;
+    }
+
+  g_free (buf);
+
+  return retval;
+}
+
+/* Blocks until the callback for the open request @seq has been called. */
+gboolean
+sapwood_pixmap_wait (guint32   seq,
+                     GError  **err)
+{
+  return sapwood_client_wait (seq, err);
+}
+
 static void
 pixbuf_proto_unref_pixmap (guint32 id)
 {
@@ -196,7 +410,7 @@ pixbuf_proto_unref_pixmap (guint32 id)
   req.base.op     = PIXBUF_OP_CLOSE;
   req.base.length = sizeof(PixbufCloseRequest);
   req.id          = id;
-  if (!pixbuf_proto_request ((char*)&req, req.base.length, NULL, 0, &err))
+  if (!sapwood_client_request (&req.base, NULL, NULL, &err))
     {
       g_warning ("close(0x%x): %s", id, err->message);
       g_error_free (err);
@@ -253,15 +467,58 @@ sapwood_pixmap_get_geometry (SapwoodPixmap *self,
   return TRUE;
 }
 
+gint
+sapwood_pixmap_get_depth (SapwoodPixmap *self)
+{
+  return self->depth;
+}
+
+/* fills in everything but the destination of @ret_rect */
 void
-sapwood_pixmap_get_pixmap (SapwoodPixmap *self,
-                           gint           x,
-                           gint           y,
-                           GdkPixmap    **pixmap,
-                           GdkBitmap    **pixmask)
+sapwood_pixmap_get_rect (SapwoodPixmap *self,
+                         gint           x,
+                         gint           y,
+                         SapwoodRect   *ret_rect)
+{
+  ret_rect->pixmap  = self->pixmap[y][x];
+  ret_rect->pixmask = self->pixmask[y][x];
+  ret_rect->solid   = PIXBUF_OPEN_RESPONSE_SOLID (self, y, x);
+  ret_rect->color   = self->color[y][x];
+
+  if (self->atlas)
+    ret_rect->src = self->src[y][x];
+  else
+    ret_rect->src.x = ret_rect->src.y = ret_rect->src.width = ret_rect->src.height = 0;
+}
+
+/* copies the @src part of @pixmap over @area, repeated from @origin_x,
+ * @origin_y on, the way a tiled GC would for a pixmap of its own */
+static void
+sapwood_draw_repeated (GdkDrawable        *draw,
+                       GdkGC              *gc,
+                       GdkDrawable        *pixmap,
+                       const GdkRectangle *src,
+                       gint                origin_x,
+                       gint                origin_y,
+                       const GdkRectangle *area)
 {
-  *pixmap  = self->pixmap[y][x];
-  *pixmask = self->pixmask[y][x];
+  gint x0, y0;
+  gint x, y;
+
+  x0 = origin_x + (area->x - origin_x) / src->width * src->width;
+  y0 = origin_y + (area->y - origin_y) / src->height * src->height;
+
+  for (y = y0; y < area->y + area->height; y += src->height)
+    for (x = x0; x < area->x + area->width; x += src->width)
+      {
+	GdkRectangle block = { x, y, src->width, src->height };
+	GdkRectangle r;
+
+	if (gdk_rectangle_intersect (&block, (GdkRectangle *) area, &r))
+	  gdk_draw_drawable (draw, gc, pixmap,
+			     src->x + r.x - x, src->y + r.y - y,
+			     r.x, r.y, r.width, r.height);
+      }
 }
 
 static void
@@ -278,7 +535,10 @@ sapwood_pixmap_render_rects_internal (SapwoodPixmap *self,
                                       SapwoodRect   *rect)
 {
   static GdkGC *mask_gc = NULL;
-  static GdkGC *draw_gc = NULL;
+  static GdkGC *mask_set_gc = NULL;
+  static GdkGC *mask_clear_gc = NULL;
+  static GdkGC *draw_gcs[33];   /* by depth, the images come in several */
+  GdkGC        *draw_gc;
   GdkGCValues   values;
   gint          xofs;
   gint          yofs;
@@ -288,12 +548,27 @@ sapwood_pixmap_render_rects_internal (SapwoodPixmap *self,
   xofs = draw_x - mask_x;
   yofs = draw_y - mask_y;
 
+  /* the server sends masks only for the partially transparent parts, the
+   * mask is needed if there are any of those or for the window shape */
   if (mask)
+    {
+      have_mask = mask_required;
+      for (n = 0; n < n_rect && !have_mask; n++)
+	if (rect[n].pixmap && rect[n].pixmask)
+	  have_mask = TRUE;
+    }
+
+  if (have_mask)
     {
       if (!mask_gc)
 	{
 	  values.fill = GDK_TILED;
 	  mask_gc = gdk_gc_new_with_values (mask, &values, GDK_GC_FILL);
+
+	  values.foreground.pixel = 1;
+	  mask_set_gc = gdk_gc_new_with_values (mask, &values, GDK_GC_FOREGROUND);
+	  values.foreground.pixel = 0;
+	  mask_clear_gc = gdk_gc_new_with_values (mask, &values, GDK_GC_FOREGROUND);
 	}
 
       for (n = 0; n < n_rect; n++)
@@ -309,7 +584,14 @@ sapwood_pixmap_render_rects_internal (SapwoodPixmap *self,
 	  else
 	    area = *dest;
 
-	  if (rect[n].pixmap && rect[n].pixmask)
+	  if (rect[n].pixmap && rect[n].pixmask && rect[n].src.width)
+	    {
+	      GdkRectangle mask_area = { area.x - xofs, area.y - yofs, area.width, area.height };
+
+	      sapwood_draw_repeated (mask, mask_set_gc, rect[n].pixmask, &rect[n].src,
+				     dest->x - xofs, dest->y - yofs, &mask_area);
+	    }
+	  else if (rect[n].pixmap && rect[n].pixmask)
 	    {
 	      values.tile = rect[n].pixmask;
 	      values.ts_x_origin = dest->x - xofs;
@@ -317,16 +599,23 @@ sapwood_pixmap_render_rects_internal (SapwoodPixmap *self,
 	      gdk_gc_set_values (mask_gc, &values, GDK_GC_TILE|GDK_GC_TS_X_ORIGIN|GDK_GC_TS_Y_ORIGIN);
 
 	      gdk_draw_rectangle (mask, mask_gc, TRUE, area.x - xofs, area.y - yofs, area.width, area.height);
-
-	      have_mask = TRUE;
+	    }
+	  else
+	    {
+	      /* opaque parts have a pixmap or a color, fully transparent
+	       * ones neither */
+	      gdk_draw_rectangle (mask, rect[n].pixmap || rect[n].solid ? mask_set_gc : mask_clear_gc,
+				  TRUE, area.x - xofs, area.y - yofs, area.width, area.height);
 	    }
 	}
     }
 
+  draw_gc = draw_gcs[gdk_drawable_get_depth (draw)];
   if (!draw_gc)
     {
       values.fill = GDK_TILED;
       draw_gc = gdk_gc_new_with_values (draw, &values, GDK_GC_FILL);
+      draw_gcs[gdk_drawable_get_depth (draw)] = draw_gc;
     }
 
   values.clip_mask = have_mask ? mask : NULL;
@@ -347,12 +636,24 @@ sapwood_pixmap_render_rects_internal (SapwoodPixmap *self,
       else
 	area = *dest;
 
-      if (rect[n].pixmap)
+      if (rect[n].pixmap && rect[n].src.width)
+	sapwood_draw_repeated (draw, draw_gc, rect[n].pixmap, &rect[n].src,
+			       dest->x, dest->y, &area);
+      else if (rect[n].pixmap)
 	{
+	  values.fill = GDK_TILED;
 	  values.tile = rect[n].pixmap;
 	  values.ts_x_origin = dest->x;
 	  values.ts_y_origin = dest->y;
-	  gdk_gc_set_values (draw_gc, &values, GDK_GC_TILE|GDK_GC_TS_X_ORIGIN|GDK_GC_TS_Y_ORIGIN);
+	  gdk_gc_set_values (draw_gc, &values, GDK_GC_FILL|GDK_GC_TILE|GDK_GC_TS_X_ORIGIN|GDK_GC_TS_Y_ORIGIN);
+
+	  gdk_draw_rectangle (draw, draw_gc, TRUE, area.x, area.y, area.width, area.height);
+	}
+      else if (rect[n].solid)
+	{
+	  values.fill = GDK_SOLID;
+	  values.foreground.pixel = rect[n].color;
+	  gdk_gc_set_values (draw_gc, &values, GDK_GC_FILL|GDK_GC_FOREGROUND);
 
 	  gdk_draw_rectangle (draw, draw_gc, TRUE, area.x, area.y, area.width, area.height);
 	}
@@ -531,7 +832,9 @@ sapwood_pixmap_render_rects (SapwoodPixmap *self,
       SapwoodRect *r = &rect[n];
       r->dest.x -= draw_x;
       r->dest.y -= draw_y;
-      if (r->pixmap && r->pixmask)
+      /* also for the transparent parts, the temporary pixmap is not
+       * cleared */
+      if ((r->pixmap && r->pixmask) || (!r->pixmap && !r->solid))
 	need_tmp_mask = TRUE;
     }
 
@@ -33,9 +33,28 @@ typedef struct _SapwoodPixmap SapwoodPixmap;
 typedef struct {
     GdkPixmap *pixmap;
     GdkPixmap *pixmask;
+    gboolean solid;     /* no pixmap, fill with color */
+    guint32 color;
+    GdkRectangle src;   /* the part of pixmap to repeat, empty to tile all of it */
     GdkRectangle dest;
 } SapwoodRect;
 
+typedef struct {
+    const char    *filename;
+    gint           border_left;
+    gint           border_right;
+    gint           border_top;
+    gint           border_bottom;
+    gpointer       user_data;
+    guint32        seq;           /* out */
+} SapwoodPixmapRequest;
+
+/* @pixmap is NULL if the image failed to load, otherwise it is owned by the
+ * callee */
+typedef void (*SapwoodPixmapFunc) (SapwoodPixmap *pixmap,
+                                   guint32        seq,
+                                   gpointer       user_data);
+
 SapwoodPixmap *sapwood_pixmap_get_for_file (const char *filename,
 					  int border_left,
 					  int border_right,
@@ -43,17 +62,34 @@ SapwoodPixmap *sapwood_pixmap_get_for_file (const char *filename,
 					  int border_bottom,
 					  GError **err) G_GNUC_INTERNAL;
 
+SapwoodPixmap *sapwood_pixmap_get_for_file_at_depth (const char *filename,
+						    int border_left,
+						    int border_right,
+						    int border_top,
+						    int border_bottom,
+						    int depth,
+						    GError **err) G_GNUC_INTERNAL;
+
+gboolean  sapwood_pixmap_open_async  (SapwoodPixmapRequest *requests,
+				      guint                 n_requests,
+				      SapwoodPixmapFunc     func,
+				      GError              **err) G_GNUC_INTERNAL;
+
+gboolean  sapwood_pixmap_wait        (guint32               seq,
+				      GError              **err) G_GNUC_INTERNAL;
+
 void      sapwood_pixmap_free         (SapwoodPixmap *self) G_GNUC_INTERNAL;
 
 gboolean  sapwood_pixmap_get_geometry (SapwoodPixmap *self,
 				      gint         *width,
 				      gint         *height) G_GNUC_INTERNAL;
 
-void      sapwood_pixmap_get_pixmap   (SapwoodPixmap *self,
+gint      sapwood_pixmap_get_depth    (SapwoodPixmap *self) G_GNUC_INTERNAL;
+
+void      sapwood_pixmap_get_rect     (SapwoodPixmap *self,
 				       gint           x,
 				       gint           y,
-				       GdkPixmap    **ret_pixmap,
-				       GdkBitmap    **ret_pixmask) G_GNUC_INTERNAL;
+				       SapwoodRect   *ret_rect) G_GNUC_INTERNAL;
 
 void      sapwood_pixmap_render_rects (SapwoodPixmap *self,
 				      GtkWidget      *widget,
@@ -0,0 +1,738 @@
+/* GTK+ Sapwood Engine
+ * Copyright (C) 2005 Nokia Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "theme-pixbuf.h"
+#include "sapwood-rc-cache.h"
+
+#ifdef ENABLE_DEBUG
+#define LOG(...) g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG(...)
+#endif
+
+#define RC_CACHE_MAGIC   0x53575243     /* "SWRC" */
+#define RC_CACHE_VERSION 2              /* bump when TOKEN_* change, too */
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  gint64  rc_mtime;
+  gint64  rc_size;
+  guint8  rc_digest[20];        /* SHA-1 of the gtkrc */
+  guint32 n_blocks;
+  guint32 n_images;
+  guint32 n_pixbufs;
+  guint32 strings_size;
+} RcCacheHeader;
+
+/* followed by the blocks (sorted by position), images, pixbufs and strings */
+
+typedef struct
+{
+  guint32 line;                 /* of the scanner at the '{' */
+  guint32 position;
+  guint32 first_image;
+  guint32 n_images;
+} RcCacheBlock;
+
+typedef struct
+{
+  guint32 detail;               /* offset in the strings, 0 for none */
+  guint16 function;
+  guint8  flags;
+  guint8  position;
+  guint8  state;
+  guint8  shadow;
+  guint8  gap_side;
+  guint8  arrow_direction;
+  guint8  orientation;
+  guint8  shaped;
+  guint16 _pad;
+  guint32 pixbufs[5];           /* background, overlay, gap_start, gap and
+                                   gap_end: index + 1, 0 for none */
+} RcCacheImage;
+
+typedef struct
+{
+  guint32 name;                 /* offsets in the strings: as in the gtkrc, */
+  guint32 found;                /* as found in the pixmap_path, */
+  guint32 dirname;              /* and resolved */
+  guint32 basename;
+  guint16 border_left;
+  guint16 border_right;
+  guint16 border_top;
+  guint16 border_bottom;
+  guint32 stretch;
+} RcCachePixbuf;
+
+typedef struct
+{
+  gchar               *filename;        /* of the table */
+  gint64               rc_mtime;
+  gint64               rc_size;
+  guint8               rc_digest[20];
+
+  /* the mapped table, NULL if it is missing or stale */
+  const RcCacheHeader *header;
+  const RcCacheBlock  *blocks;
+  const RcCacheImage  *images;
+  const RcCachePixbuf *pixbufs;
+  const gchar         *strings;
+
+  /* the blocks parsed since, for a new table */
+  GArray              *new_blocks;      /* RcCacheBlock */
+  GArray              *new_images;      /* RcCacheImage */
+  GArray              *new_pixbufs;     /* RcCachePixbuf */
+  GString             *new_strings;
+  GHashTable          *new_offsets;     /* interned string -> offset */
+} RcCache;
+
+typedef struct
+{
+  gchar *name;
+  gchar *found;
+} RcCacheFile;
+
+static GHashTable *rc_caches = NULL;    /* gtkrc path -> RcCache */
+static GHashTable *rc_files  = NULL;    /* resolved path -> RcCacheFile, of
+                                           the block being parsed */
+static guint       write_id  = 0;
+
+static void
+rc_cache_file_free (RcCacheFile *file)
+{
+  g_free (file->name);
+  g_free (file->found);
+  g_free (file);
+}
+
+/* the contents of the gtkrc, for a change that kept its time and size */
+static gboolean
+rc_cache_digest (const gchar *filename,
+                 guint8       digest[20])
+{
+  GChecksum *checksum;
+  gchar     *contents;
+  gsize      length, digest_len = 20;
+
+  if (!g_file_get_contents (filename, &contents, &length, NULL))
+    return FALSE;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *) contents, length);
+  g_checksum_get_digest (checksum, digest, &digest_len);
+  g_checksum_free (checksum);
+  g_free (contents);
+
+  return TRUE;
+}
+
+static gboolean
+rc_cache_stat (const gchar *filename,
+               gint64      *mtime,
+               gint64      *size)
+{
+  struct stat st;
+
+  if (stat (filename, &st) < 0)
+    return FALSE;
+
+  *mtime = st.st_mtime;
+  *size  = st.st_size;
+  return TRUE;
+}
+
+static void
+rc_cache_free_recording (RcCache *cache)
+{
+  if (!cache->new_blocks)
+    return;
+
+  g_array_free (cache->new_blocks, TRUE);
+  g_array_free (cache->new_images, TRUE);
+  g_array_free (cache->new_pixbufs, TRUE);
+  g_string_free (cache->new_strings, TRUE);
+  g_hash_table_destroy (cache->new_offsets);
+  cache->new_blocks = NULL;
+}
+
+static gint
+compare_blocks (gconstpointer a,
+                gconstpointer b)
+{
+  const RcCacheBlock *ba = a;
+  const RcCacheBlock *bb = b;
+
+  if (ba->line != bb->line)
+    return ba->line < bb->line ? -1 : 1;
+
+  return ba->position < bb->position ? -1 : ba->position > bb->position;
+}
+
+/* the table is only trusted once all its offsets were checked */
+static gboolean
+rc_cache_validate (RcCache     *cache,
+                   const gchar *data,
+                   gsize        size)
+{
+  const RcCacheHeader *header = (const RcCacheHeader *) data;
+  guint64              expected;
+  guint                i, k;
+
+  if (size < sizeof (RcCacheHeader) ||
+      header->magic != RC_CACHE_MAGIC ||
+      header->version != RC_CACHE_VERSION ||
+      header->rc_mtime != cache->rc_mtime ||
+      header->rc_size != cache->rc_size ||
+      memcmp (header->rc_digest, cache->rc_digest, sizeof (header->rc_digest)))
+    return FALSE;
+
+  expected = sizeof (RcCacheHeader) +
+             (guint64) header->n_blocks * sizeof (RcCacheBlock) +
+             (guint64) header->n_images * sizeof (RcCacheImage) +
+             (guint64) header->n_pixbufs * sizeof (RcCachePixbuf) +
+             header->strings_size;
+  if (expected != size || !header->strings_size)
+    return FALSE;
+
+  cache->blocks  = (const RcCacheBlock *) (header + 1);
+  cache->images  = (const RcCacheImage *) (cache->blocks + header->n_blocks);
+  cache->pixbufs = (const RcCachePixbuf *) (cache->images + header->n_images);
+  cache->strings = (const gchar *) (cache->pixbufs + header->n_pixbufs);
+
+  if (cache->strings[header->strings_size - 1] != '\0')
+    return FALSE;
+
+  for (i = 0; i < header->n_blocks; i++)
+    if ((guint64) cache->blocks[i].first_image + cache->blocks[i].n_images > header->n_images ||
+        (i > 0 && compare_blocks (&cache->blocks[i - 1], &cache->blocks[i]) >= 0))
+      return FALSE;
+
+  for (i = 0; i < header->n_images; i++)
+    {
+      if (cache->images[i].detail >= header->strings_size)
+        return FALSE;
+      for (k = 0; k < G_N_ELEMENTS (cache->images[i].pixbufs); k++)
+        if (cache->images[i].pixbufs[k] > header->n_pixbufs)
+          return FALSE;
+    }
+
+  for (i = 0; i < header->n_pixbufs; i++)
+    if (cache->pixbufs[i].name >= header->strings_size ||
+        cache->pixbufs[i].found >= header->strings_size ||
+        cache->pixbufs[i].dirname >= header->strings_size ||
+        cache->pixbufs[i].basename >= header->strings_size)
+      return FALSE;
+
+  cache->header = header;
+  return TRUE;
+}
+
+/* maps the table for the gtkrc as it is now, or starts recording a new one */
+static void
+rc_cache_open (RcCache     *cache,
+               const gchar *rc_filename,
+               gint64       rc_mtime,
+               gint64       rc_size)
+{
+  struct stat st;
+  gpointer    data = MAP_FAILED;
+  int         fd;
+
+  rc_cache_free_recording (cache);
+
+  /* a previous mapping is never unmapped, its strings are interned */
+  cache->header   = NULL;
+  cache->rc_mtime = rc_mtime;
+  cache->rc_size  = rc_size;
+
+  /* neither used nor recorded without the digest */
+  if (!rc_cache_digest (rc_filename, cache->rc_digest))
+    return;
+
+  fd = open (cache->filename, O_RDONLY);
+  if (fd >= 0)
+    {
+      if (fstat (fd, &st) == 0 && st.st_size > 0)
+        data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      close (fd);
+    }
+
+  if (data != MAP_FAILED)
+    {
+      if (rc_cache_validate (cache, data, st.st_size))
+        return;
+
+      LOG ("%s: stale gtkrc cache", cache->filename);
+      munmap (data, st.st_size);
+    }
+
+  cache->new_blocks  = g_array_new (FALSE, FALSE, sizeof (RcCacheBlock));
+  cache->new_images  = g_array_new (FALSE, FALSE, sizeof (RcCacheImage));
+  cache->new_pixbufs = g_array_new (FALSE, FALSE, sizeof (RcCachePixbuf));
+  cache->new_strings = g_string_new_len ("", 1);
+  cache->new_offsets = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+/* finds the table of the gtkrc the scanner reads; only gtkrc files are
+ * cached, not strings */
+static RcCache *
+rc_cache_get (GScanner *scanner)
+{
+  RcCache *cache;
+
+  if (scanner->next_token != G_TOKEN_NONE ||
+      !scanner->input_name || !g_path_is_absolute (scanner->input_name))
+    return NULL;
+
+  if (!rc_caches)
+    rc_caches = g_hash_table_new (g_str_hash, g_str_equal);
+
+  cache = g_hash_table_lookup (rc_caches, scanner->input_name);
+  if (!cache)
+    {
+      gchar *checksum, *basename;
+      gint64 rc_mtime, rc_size;
+
+      if (!rc_cache_stat (scanner->input_name, &rc_mtime, &rc_size))
+        return NULL;
+
+      checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+                                                scanner->input_name, -1);
+      basename = g_strconcat (checksum, ".gtkrc.cache", NULL);
+
+      cache = g_new0 (RcCache, 1);
+      cache->filename = g_build_filename (g_get_user_cache_dir (), "sapwood",
+                                          basename, NULL);
+      g_hash_table_insert (rc_caches, g_strdup (scanner->input_name), cache);
+
+      g_free (basename);
+      g_free (checksum);
+
+      rc_cache_open (cache, scanner->input_name, rc_mtime, rc_size);
+    }
+
+  return cache;
+}
+
+static const RcCacheBlock *
+rc_cache_find_block (RcCache  *cache,
+                     GScanner *scanner)
+{
+  RcCacheBlock key;
+  guint        lo = 0, hi = cache->header->n_blocks;
+
+  key.line     = scanner->line;
+  key.position = scanner->position;
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+      gint  cmp = compare_blocks (&cache->blocks[mid], &key);
+
+      if (cmp == 0)
+        return &cache->blocks[mid];
+      else if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return NULL;
+}
+
+/* the pixmap_path and the files including the gtkrc may differ from the
+ * application that wrote the table: the files of the block must still be
+ * found where they were, or the block is parsed again */
+static gboolean
+rc_cache_check_files (RcCache            *cache,
+                      const RcCacheBlock *block,
+                      GtkSettings        *settings,
+                      GScanner           *scanner)
+{
+  GHashTable *checked = g_hash_table_new (NULL, NULL);
+  gboolean    valid = TRUE;
+  guint       i, k;
+
+  for (i = 0; i < block->n_images && valid; i++)
+    {
+      const RcCacheImage *image = &cache->images[block->first_image + i];
+
+      for (k = 0; k < G_N_ELEMENTS (image->pixbufs) && valid; k++)
+        {
+          const RcCachePixbuf *pixbuf;
+          gchar               *found;
+
+          if (!image->pixbufs[k] ||
+              g_hash_table_lookup (checked, GUINT_TO_POINTER (image->pixbufs[k])))
+            continue;
+
+          pixbuf = &cache->pixbufs[image->pixbufs[k] - 1];
+          found = gtk_rc_find_pixmap_in_path (settings, scanner,
+                                              cache->strings + pixbuf->name);
+          valid = found && !strcmp (found, cache->strings + pixbuf->found);
+          g_free (found);
+
+          g_hash_table_insert (checked, GUINT_TO_POINTER (image->pixbufs[k]),
+                               GUINT_TO_POINTER (TRUE));
+        }
+    }
+
+  g_hash_table_destroy (checked);
+
+  return valid;
+}
+
+/* moves the scanner past the '}' closing the block, as the parser would */
+static gboolean
+rc_cache_skip_block (GScanner *scanner)
+{
+  guint depth = 1;
+
+  while (depth)
+    {
+      switch (g_scanner_get_next_token (scanner))
+        {
+        case G_TOKEN_LEFT_CURLY:
+          depth++;
+          break;
+        case G_TOKEN_RIGHT_CURLY:
+          depth--;
+          break;
+        case G_TOKEN_EOF:
+        case G_TOKEN_ERROR:
+          return FALSE;
+        default:
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+static ThemePixbuf *
+rc_cache_get_pixbuf (RcCache *cache,
+                     guint32  index)
+{
+  const RcCachePixbuf *pixbuf;
+  ThemePixbuf         *theme_pb;
+
+  if (!index)
+    return NULL;
+
+  pixbuf = &cache->pixbufs[index - 1];
+
+  theme_pb = theme_pixbuf_new ();
+  theme_pixbuf_set_path (theme_pb,
+                         g_intern_static_string (cache->strings + pixbuf->dirname),
+                         cache->strings + pixbuf->basename);
+  theme_pixbuf_set_border (theme_pb,
+                           pixbuf->border_left, pixbuf->border_right,
+                           pixbuf->border_top, pixbuf->border_bottom);
+  theme_pixbuf_set_stretch (theme_pb, pixbuf->stretch);
+
+  return theme_pixbuf_canonicalize (theme_pb);
+}
+
+gboolean
+sapwood_rc_cache_lookup (GtkSettings  *settings,
+                         GScanner     *scanner,
+                         GList       **img_list)
+{
+  const RcCacheBlock *block;
+  RcCache            *cache;
+  gint64              rc_mtime, rc_size;
+  guint               i;
+
+  /* a new block is parsed */
+  if (rc_files)
+    g_hash_table_remove_all (rc_files);
+
+  cache = rc_cache_get (scanner);
+  if (!cache)
+    return FALSE;
+
+  /* GTK+ read the file just now, a theme being edited is noticed */
+  if (!rc_cache_stat (scanner->input_name, &rc_mtime, &rc_size))
+    return FALSE;
+  if (rc_mtime != cache->rc_mtime || rc_size != cache->rc_size)
+    rc_cache_open (cache, scanner->input_name, rc_mtime, rc_size);
+
+  if (!cache->header)
+    return FALSE;
+
+  block = rc_cache_find_block (cache, scanner);
+  if (!block || !rc_cache_check_files (cache, block, settings, scanner))
+    return FALSE;
+
+  /* the parser reports a block that is cut short */
+  if (!rc_cache_skip_block (scanner))
+    return FALSE;
+
+  for (i = 0; i < block->n_images; i++)
+    {
+      const RcCacheImage *image = &cache->images[block->first_image + i];
+      ThemeImage         *data;
+
+      data = g_new0 (ThemeImage, 1);
+      data->refcount = 1;
+
+      if (image->detail)
+        data->match_data.detail = g_intern_static_string (cache->strings + image->detail);
+      data->match_data.function        = image->function;
+      data->match_data.flags           = image->flags;
+      data->match_data.position        = image->position;
+      data->match_data.state           = image->state;
+      data->match_data.shadow          = image->shadow;
+      data->match_data.gap_side        = image->gap_side;
+      data->match_data.arrow_direction = image->arrow_direction;
+      data->match_data.orientation     = image->orientation;
+      data->background_shaped          = image->shaped;
+
+      data->background = rc_cache_get_pixbuf (cache, image->pixbufs[0]);
+      data->overlay    = rc_cache_get_pixbuf (cache, image->pixbufs[1]);
+      data->gap_start  = rc_cache_get_pixbuf (cache, image->pixbufs[2]);
+      data->gap        = rc_cache_get_pixbuf (cache, image->pixbufs[3]);
+      data->gap_end    = rc_cache_get_pixbuf (cache, image->pixbufs[4]);
+
+      *img_list = g_list_prepend (*img_list, data);
+    }
+
+  return TRUE;
+}
+
+void
+sapwood_rc_cache_note_file (ThemePixbuf *theme_pb,
+                            const gchar *name,
+                            const gchar *found)
+{
+  RcCacheFile *file;
+
+  if (!theme_pb->basename)
+    return;
+
+  if (!rc_files)
+    rc_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify) rc_cache_file_free);
+
+  file = g_new (RcCacheFile, 1);
+  file->name  = g_strdup (name);
+  file->found = g_strdup (found);
+  g_hash_table_insert (rc_files,
+                       g_build_filename (theme_pb->dirname, theme_pb->basename, NULL),
+                       file);
+}
+
+static guint32
+rc_cache_add_string (RcCache     *cache,
+                     const gchar *string)
+{
+  gpointer offset;
+
+  /* the details and dirnames are interned */
+  string = g_intern_string (string);
+  if (g_hash_table_lookup_extended (cache->new_offsets, string, NULL, &offset))
+    return GPOINTER_TO_UINT (offset);
+
+  offset = GUINT_TO_POINTER (cache->new_strings->len);
+  g_string_append_len (cache->new_strings, string, strlen (string) + 1);
+  g_hash_table_insert (cache->new_offsets, (gpointer) string, offset);
+
+  return GPOINTER_TO_UINT (offset);
+}
+
+/* returns the index + 1 of the pixbuf, 0 for none and G_MAXUINT32 if its
+ * file was not noted */
+static guint32
+rc_cache_add_pixbuf (RcCache     *cache,
+                     ThemePixbuf *theme_pb)
+{
+  RcCachePixbuf  pixbuf;
+  RcCacheFile   *file;
+  gchar         *path;
+  guint          i;
+
+  if (!theme_pb)
+    return 0;
+
+  path = g_build_filename (theme_pb->dirname, theme_pb->basename, NULL);
+  file = rc_files ? g_hash_table_lookup (rc_files, path) : NULL;
+  g_free (path);
+  if (!file)
+    return G_MAXUINT32;
+
+  memset (&pixbuf, 0, sizeof (pixbuf));
+  pixbuf.name          = rc_cache_add_string (cache, file->name);
+  pixbuf.found         = rc_cache_add_string (cache, file->found);
+  pixbuf.dirname       = rc_cache_add_string (cache, theme_pb->dirname);
+  pixbuf.basename      = rc_cache_add_string (cache, theme_pb->basename);
+  pixbuf.border_left   = theme_pb->border_left;
+  pixbuf.border_right  = theme_pb->border_right;
+  pixbuf.border_top    = theme_pb->border_top;
+  pixbuf.border_bottom = theme_pb->border_bottom;
+  pixbuf.stretch       = theme_pb->stretch;
+
+  for (i = 0; i < cache->new_pixbufs->len; i++)
+    if (!memcmp (&g_array_index (cache->new_pixbufs, RcCachePixbuf, i),
+                 &pixbuf, sizeof (pixbuf)))
+      return i + 1;
+
+  g_array_append_val (cache->new_pixbufs, pixbuf);
+
+  return cache->new_pixbufs->len;
+}
+
+static void
+rc_cache_write (RcCache *cache)
+{
+  RcCacheHeader  header;
+  GString       *contents;
+  GError        *err = NULL;
+  gchar         *dirname;
+
+  g_array_sort (cache->new_blocks, compare_blocks);
+
+  memset (&header, 0, sizeof (header));
+  header.magic        = RC_CACHE_MAGIC;
+  header.version      = RC_CACHE_VERSION;
+  header.rc_mtime     = cache->rc_mtime;
+  header.rc_size      = cache->rc_size;
+  memcpy (header.rc_digest, cache->rc_digest, sizeof (header.rc_digest));
+  header.n_blocks     = cache->new_blocks->len;
+  header.n_images     = cache->new_images->len;
+  header.n_pixbufs    = cache->new_pixbufs->len;
+  header.strings_size = cache->new_strings->len;
+
+  contents = g_string_new_len ((const gchar *) &header, sizeof (header));
+  g_string_append_len (contents, cache->new_blocks->data,
+                       cache->new_blocks->len * sizeof (RcCacheBlock));
+  g_string_append_len (contents, cache->new_images->data,
+                       cache->new_images->len * sizeof (RcCacheImage));
+  g_string_append_len (contents, cache->new_pixbufs->data,
+                       cache->new_pixbufs->len * sizeof (RcCachePixbuf));
+  g_string_append_len (contents, cache->new_strings->str,
+                       cache->new_strings->len);
+
+  /* written to a temporary file and renamed, the other applications may
+   * have the old one mapped */
+  dirname = g_path_get_dirname (cache->filename);
+  if (g_mkdir_with_parents (dirname, 0700) < 0 ||
+      !g_file_set_contents (cache->filename, contents->str, contents->len, &err))
+    {
+      LOG ("%s: %s", cache->filename, err ? err->message : g_strerror (errno));
+      if (err)
+        g_error_free (err);
+    }
+
+  g_free (dirname);
+  g_string_free (contents, TRUE);
+
+  /* this process already has the images, the next ones map the table */
+  rc_cache_free_recording (cache);
+}
+
+static gboolean
+rc_cache_write_all (gpointer user_data)
+{
+  GHashTableIter iter;
+  RcCache       *cache;
+
+  g_hash_table_iter_init (&iter, rc_caches);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &cache))
+    if (cache->new_blocks && cache->new_blocks->len)
+      rc_cache_write (cache);
+
+  write_id = 0;
+  return FALSE;
+}
+
+void
+sapwood_rc_cache_record (GScanner    *scanner,
+                         guint        line,
+                         guint        position,
+                         GList       *images)
+{
+  RcCacheBlock  block;
+  RcCache      *cache;
+  guint         i, k;
+
+  cache = rc_cache_get (scanner);
+  if (!cache || !cache->new_blocks)
+    return;
+
+  memset (&block, 0, sizeof (block));
+  block.line         = line;
+  block.position     = position;
+
+  /* the same gtkrc is parsed again on theme changes */
+  for (i = 0; i < cache->new_blocks->len; i++)
+    if (!compare_blocks (&g_array_index (cache->new_blocks, RcCacheBlock, i), &block))
+      return;
+
+  block.first_image  = cache->new_images->len;
+
+  for (; images; images = images->next, block.n_images++)
+    {
+      ThemeImage   *data = images->data;
+      RcCacheImage  image;
+
+      memset (&image, 0, sizeof (image));
+      if (data->match_data.detail)
+        image.detail = rc_cache_add_string (cache, data->match_data.detail);
+      image.function        = data->match_data.function;
+      image.flags           = data->match_data.flags;
+      image.position        = data->match_data.position;
+      image.state           = data->match_data.state;
+      image.shadow          = data->match_data.shadow;
+      image.gap_side        = data->match_data.gap_side;
+      image.arrow_direction = data->match_data.arrow_direction;
+      image.orientation     = data->match_data.orientation;
+      image.shaped          = data->background_shaped;
+      image.pixbufs[0]      = rc_cache_add_pixbuf (cache, data->background);
+      image.pixbufs[1]      = rc_cache_add_pixbuf (cache, data->overlay);
+      image.pixbufs[2]      = rc_cache_add_pixbuf (cache, data->gap_start);
+      image.pixbufs[3]      = rc_cache_add_pixbuf (cache, data->gap);
+      image.pixbufs[4]      = rc_cache_add_pixbuf (cache, data->gap_end);
+
+      for (k = 0; k < G_N_ELEMENTS (image.pixbufs); k++)
+        if (image.pixbufs[k] == G_MAXUINT32)
+          {
+            /* not parsed from this block, drop it */
+            g_array_set_size (cache->new_images, block.first_image);
+            return;
+          }
+
+      g_array_append_val (cache->new_images, image);
+    }
+
+  g_array_append_val (cache->new_blocks, block);
+
+  /* once the application is done parsing its gtkrc files */
+  if (!write_id)
+    write_id = g_idle_add (rc_cache_write_all, NULL);
+}
@@ -0,0 +1,56 @@
+/* GTK+ Sapwood Engine
+ * Copyright (C) 2005 Nokia Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SAPWOOD_RC_CACHE_H__
+#define __SAPWOOD_RC_CACHE_H__
+
+#include "theme-pixbuf.h"
+
+G_BEGIN_DECLS
+
+/* Compiled image tables of the engine "sapwood" {} blocks of a gtkrc, kept
+ * in a file of the user cache directory and mapped read-only. The table of
+ * a gtkrc is keyed by its modification time, size and SHA-1, its blocks by
+ * the line and position of their '{', and the files of a block are looked
+ * up in the pixmap_path again before it is used.
+ */
+
+/* called with the scanner right after the '{' of the block; on success the
+ * scanner is moved past its '}' and the ThemeImages of the block are
+ * prepended to @img_list in reverse order, like the parser does */
+G_GNUC_INTERNAL gboolean sapwood_rc_cache_lookup    (GtkSettings  *settings,
+                                                     GScanner     *scanner,
+                                                     GList       **img_list);
+
+/* notes that the parser found the file of @theme_pb as @found in the
+ * pixmap_path, looking for @name */
+G_GNUC_INTERNAL void     sapwood_rc_cache_note_file (ThemePixbuf  *theme_pb,
+                                                     const gchar  *name,
+                                                     const gchar  *found);
+
+/* records the ThemeImages the parser built from the block whose '{' was at
+ * @line and @position, the scanner being right after its '}' */
+G_GNUC_INTERNAL void     sapwood_rc_cache_record    (GScanner     *scanner,
+                                                     guint         line,
+                                                     guint         position,
+                                                     GList        *images);
+
+G_END_DECLS
+
+#endif /* __SAPWOOD_RC_CACHE_H__ */
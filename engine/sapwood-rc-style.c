@@ -26,6 +26,7 @@
 #include "theme-pixbuf.h"
 #include "sapwood-style.h"
 #include "sapwood-rc-style.h"
+#include "sapwood-rc-cache.h"
 
 static void      sapwood_rc_style_finalize     (GObject            *object);
 static guint     sapwood_rc_style_parse        (GtkRcStyle         *rc_style,
@@ -37,6 +38,10 @@ static GtkStyle *sapwood_rc_style_create_style (GtkRcStyle         *rc_style);
 
 static void theme_image_unref (ThemeImage *data);
 
+/* set when the block being parsed has a file that could not be found, or
+ * another warning that should not be lost by caching it */
+static gboolean parse_incomplete = FALSE;
+
 static struct
   {
     gchar *name;
@@ -142,6 +147,8 @@ sapwood_rc_style_finalize (GObject *object)
 {
   SapwoodRcStyle *rc_style = SAPWOOD_RC_STYLE (object);
 
+  if (rc_style->img_index)
+    theme_image_index_free (rc_style->img_index);
   g_list_foreach (rc_style->img_list, (GFunc) theme_image_unref, NULL);
   g_list_free (rc_style->img_list);
 
@@ -197,9 +204,13 @@ theme_parse_file (GtkSettings  *settings,
   if (pixmap)
     {
       theme_pixbuf_set_filename (*theme_pb, pixmap);
+      sapwood_rc_cache_note_file (*theme_pb, scanner->value.v_string, pixmap);
       g_free (pixmap);
     }
 
+  if (!(*theme_pb)->basename)
+    parse_incomplete = TRUE;
+
   return G_TOKEN_NONE;
 }
 
@@ -331,10 +342,7 @@ theme_parse_detail (GScanner   *scanner,
   if (token != G_TOKEN_STRING)
     return G_TOKEN_STRING;
 
-  if (data->match_data.detail)
-    g_free (data->match_data.detail);
-
-  data->match_data.detail = g_strdup (scanner->value.v_string);
+  data->match_data.detail = g_intern_string (scanner->value.v_string);
 
   return G_TOKEN_NONE;
 }
@@ -575,8 +583,6 @@ theme_image_unref (ThemeImage *data)
   data->refcount--;
   if (data->refcount == 0)
     {
-      if (data->match_data.detail)
-	g_free (data->match_data.detail);
       if (data->background)
 	theme_pixbuf_unref (data->background);
       if (data->overlay)
@@ -602,20 +608,12 @@ validate_pixbuf (GScanner     *scanner,
   if (!(*theme_pb)->basename)
     {
       g_scanner_warn (scanner, "%sborder (or %sstretch) without valid %sfile", name, name, name);
+      parse_incomplete = TRUE;
       theme_pixbuf_unref (*theme_pb);
       *theme_pb = NULL;
     }
   else
-    {
-      gboolean warn = FALSE;
-
-      *theme_pb = theme_pixbuf_canonicalize (*theme_pb, &warn);
-
-      if (warn)
-        g_scanner_warn (scanner, "file %s previously referenced with different"
-                        " border or stretch values. Ignoring the new values.",
-                        (*theme_pb)->basename);
-    }
+    *theme_pb = theme_pixbuf_canonicalize (*theme_pb);
 }
 
 static guint
@@ -755,6 +753,20 @@ sapwood_rc_style_parse (GtkRcStyle  *rc_style,
   guint token;
   gint i;
   ThemeImage *img = NULL;
+  guint line, position, n_inherited;
+  gboolean cacheable = TRUE;
+
+  /* the images of the block as they were parsed before */
+  if (sapwood_rc_cache_lookup (settings, scanner, &sapwood_style->img_list))
+    {
+      sapwood_style->img_list = g_list_reverse (sapwood_style->img_list);
+      return G_TOKEN_NONE;
+    }
+
+  line = scanner->line;
+  position = scanner->position;
+  n_inherited = g_list_length (sapwood_style->img_list);
+  parse_incomplete = FALSE;
 
   /* Set up a new scope in this scanner. */
 
@@ -789,6 +801,7 @@ sapwood_rc_style_parse (GtkRcStyle  *rc_style,
       switch (token)
 	{
 	case TOKEN_SHADOWCOLOR:
+	  cacheable = FALSE;
 	  token = theme_parse_shadowcolor (scanner, sapwood_style, &sapwood_style->shadowcolor);
 	  break;
 	case TOKEN_IMAGE:
@@ -815,6 +828,10 @@ sapwood_rc_style_parse (GtkRcStyle  *rc_style,
 
   sapwood_style->img_list = g_list_reverse (sapwood_style->img_list);
 
+  if (cacheable && !parse_incomplete)
+    sapwood_rc_cache_record (scanner, line, position,
+			     g_list_nth (sapwood_style->img_list, n_inherited));
+
   return G_TOKEN_NONE;
 }
 
@@ -836,6 +853,12 @@ sapwood_rc_style_merge (GtkRcStyle *dest,
 
       if (pixbuf_src->img_list)
 	{
+	  if (pixbuf_dest->img_index)
+	    {
+	      theme_image_index_free (pixbuf_dest->img_index);
+	      pixbuf_dest->img_index = NULL;
+	    }
+
 	  /* Copy src image list and append to dest image list */
 
 	  tmp_list2 = g_list_last (pixbuf_dest->img_list);
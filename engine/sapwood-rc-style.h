@@ -26,6 +26,7 @@
 #define __SAPWOOD_RC_STYLE_H__
 
 #include <gtk/gtk.h>
+#include "theme-image-index.h"
 
 typedef struct _SapwoodRcStyle SapwoodRcStyle;
 typedef struct _SapwoodRcStyleClass SapwoodRcStyleClass;
@@ -44,6 +45,7 @@ struct _SapwoodRcStyle
   GtkRcStyle parent_instance;
 
   GList     *img_list;
+  ThemeImageIndex *img_index;   /* of img_list, built on the first match */
   guint      has_shadow      : 1;
   GdkColor   shadowcolor;
 };
@@ -58,73 +58,53 @@ enum_value_to_string (GType enum_type,
 }
 #endif /* ENABLE_DEBUG */
 
+/* the image is about to be painted, load the pixmaps it does not have yet
+ * in one go rather than one server round trip for each */
+static void
+prefetch_theme_image (ThemeImage *image)
+{
+  ThemePixbuf *pixbufs[5];
+  GPtrArray   *missing = NULL;
+  guint        i;
+
+  pixbufs[0] = image->background;
+  pixbufs[1] = image->overlay;
+  pixbufs[2] = image->gap_start;
+  pixbufs[3] = image->gap;
+  pixbufs[4] = image->gap_end;
+
+  for (i = 0; i < G_N_ELEMENTS (pixbufs); i++)
+    if (pixbufs[i] && !pixbufs[i]->pixmap)
+      {
+	if (!missing)
+	  missing = g_ptr_array_sized_new (G_N_ELEMENTS (pixbufs));
+	g_ptr_array_add (missing, pixbufs[i]);
+      }
+
+  /* a single one is loaded by theme_pixbuf_get_pixmap() just as well */
+  if (missing && missing->len > 1)
+    theme_pixbuf_prefetch (missing);
+
+  if (missing)
+    g_ptr_array_free (missing, TRUE);
+}
+
 static ThemeImage *
 match_theme_image (GtkStyle       *style,
 		   ThemeMatchData *match_data)
 {
-  GList *tmp_list;
+  SapwoodRcStyle *rc_style = SAPWOOD_RC_STYLE (style->rc_style);
 
-  tmp_list = SAPWOOD_RC_STYLE (style->rc_style)->img_list;
-
-  while (tmp_list)
-    {
-      guint flags;
-      ThemeImage *image = tmp_list->data;
-      tmp_list = tmp_list->next;
-
-      if (match_data->function != image->match_data.function)
-	continue;
+  ThemeImage     *image;
 
-      flags = match_data->flags & image->match_data.flags;
+  if (!rc_style->img_index)
+    rc_style->img_index = theme_image_index_new (rc_style->img_list);
 
-      if (flags != image->match_data.flags) /* Required components not present */
-	continue;
-
-      if ((flags & THEME_MATCH_STATE) &&
-	  match_data->state != image->match_data.state)
-	continue;
-
-      if ((flags & THEME_MATCH_POSITION) &&
-	  match_data->position != image->match_data.position)
-	continue;
-
-      if ((flags & THEME_MATCH_SHADOW) &&
-	  match_data->shadow != image->match_data.shadow)
-	continue;
-
-      if ((flags & THEME_MATCH_ARROW_DIRECTION) &&
-	  match_data->arrow_direction != image->match_data.arrow_direction)
-	continue;
-
-      if ((flags & THEME_MATCH_ORIENTATION) &&
-	  match_data->orientation != image->match_data.orientation)
-	continue;
-
-      if ((flags & THEME_MATCH_GAP_SIDE) &&
-	  match_data->gap_side != image->match_data.gap_side)
-	continue;
-
-      /* simple pattern matching for (treeview) details
-       * in gtkrc 'detail = "*_start"' will match all calls with detail ending
-       * with '_start' such as 'cell_even_start', 'cell_odd_start', etc.
-       */
-      if (image->match_data.detail)
-        {
-          if (!match_data->detail)
-            continue;
-          else if (image->match_data.detail[0] == '*')
-            {
-              if (!g_str_has_suffix (match_data->detail, image->match_data.detail + 1))
-                continue;
-            }
-          else if (strcmp (match_data->detail, image->match_data.detail) != 0)
-            continue;
-        }
-
-      return image;
-    }
+  image = theme_image_index_match (rc_style->img_index, match_data);
+  if (image)
+    prefetch_theme_image (image);
 
-  return NULL;
+  return image;
 }
 
 static GdkBitmap *
@@ -0,0 +1,390 @@
+/* GTK+ Sapwood Engine
+ * Copyright (C) 2005 Nokia Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "theme-image-index.h"
+
+#define N_FUNCTIONS   (TOKEN_D_STEPPER - TOKEN_D_HLINE + 1)
+#define STATE_NONE    (GTK_STATE_INSENSITIVE + 1)       /* no state given */
+#define N_STATE_SLOTS (STATE_NONE + 1)
+
+typedef struct
+{
+  ThemeImage *image;
+  guint       order;            /* in the list */
+} IndexEntry;
+
+/* a trie of the reversed suffixes of the wildcard details: the node for a
+ * paint call's detail is the deepest one its reversed detail leads to */
+typedef struct _SuffixNode SuffixNode;
+
+struct _SuffixNode
+{
+  gchar       c;
+  SuffixNode *children;
+  SuffixNode *next;             /* sibling */
+  GArray     *own;              /* IndexEntry, the suffix ends here */
+  GArray     *matches;          /* IndexEntry, the suffix ends here or at an
+                                   ancestor: all the images matching */
+};
+
+/* the images for a function and state, each list in the order of the
+ * images; NULL for an empty list */
+typedef struct
+{
+  GArray     *plain;            /* IndexEntry, without a detail */
+  SuffixNode *suffixes;         /* with a "*suffix" detail */
+  GHashTable *details;          /* interned detail -> GArray of IndexEntry */
+} ImageBucket;
+
+struct _ThemeImageIndex
+{
+  guint32      functions;       /* bit set for the functions with images */
+  ImageBucket *buckets[N_FUNCTIONS * N_STATE_SLOTS];
+};
+
+static void
+entries_free (GArray *entries)
+{
+  if (entries)
+    g_array_free (entries, TRUE);
+}
+
+static GArray *
+entries_append (GArray     *entries,
+                IndexEntry *entry)
+{
+  if (!entries)
+    entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+
+  return g_array_append_vals (entries, entry, 1);
+}
+
+static void
+suffix_node_insert (SuffixNode  **root,
+                    const gchar  *suffix,
+                    IndexEntry   *entry)
+{
+  SuffixNode  *node;
+  const gchar *p;
+
+  if (!*root)
+    *root = g_new0 (SuffixNode, 1);
+
+  node = *root;
+  for (p = suffix + strlen (suffix); p > suffix; )
+    {
+      SuffixNode *child;
+
+      p--;
+      for (child = node->children; child; child = child->next)
+        if (child->c == *p)
+          break;
+
+      if (!child)
+        {
+          child = g_new0 (SuffixNode, 1);
+          child->c = *p;
+          child->next = node->children;
+          node->children = child;
+        }
+
+      node = child;
+    }
+
+  node->own = entries_append (node->own, entry);
+}
+
+/* merges the images of the ancestors into every node, so a lookup only
+ * needs the last node it reaches */
+static void
+suffix_node_finish (SuffixNode *node,
+                    GArray     *inherited)
+{
+  SuffixNode *child;
+  guint       i = 0, j = 0;
+  guint       n_inherited = inherited ? inherited->len : 0;
+  guint       n_own = node->own ? node->own->len : 0;
+
+  if (n_inherited + n_own)
+    node->matches = g_array_sized_new (FALSE, FALSE, sizeof (IndexEntry),
+                                       n_inherited + n_own);
+
+  while (i < n_inherited || j < n_own)
+    {
+      if (j == n_own ||
+          (i < n_inherited &&
+           g_array_index (inherited, IndexEntry, i).order <
+           g_array_index (node->own, IndexEntry, j).order))
+        g_array_append_val (node->matches, g_array_index (inherited, IndexEntry, i++));
+      else
+        g_array_append_val (node->matches, g_array_index (node->own, IndexEntry, j++));
+    }
+
+  entries_free (node->own);
+  node->own = NULL;
+
+  for (child = node->children; child; child = child->next)
+    suffix_node_finish (child, node->matches);
+}
+
+static void
+suffix_node_free (SuffixNode *node)
+{
+  while (node)
+    {
+      SuffixNode *next = node->next;
+
+      suffix_node_free (node->children);
+      entries_free (node->own);
+      entries_free (node->matches);
+      g_free (node);
+
+      node = next;
+    }
+}
+
+static const GArray *
+suffix_node_lookup (SuffixNode  *node,
+                    const gchar *detail)
+{
+  const gchar *p;
+
+  for (p = detail + strlen (detail); p > detail; )
+    {
+      SuffixNode *child;
+
+      p--;
+      for (child = node->children; child; child = child->next)
+        if (child->c == *p)
+          break;
+
+      if (!child)
+        break;
+
+      node = child;
+    }
+
+  return node->matches;
+}
+
+static void
+theme_image_index_add (ThemeImageIndex *index,
+                       guint            function,
+                       guint            state,
+                       IndexEntry      *entry)
+{
+  ImageBucket **bucket = &index->buckets[function * N_STATE_SLOTS + state];
+  const gchar  *detail = entry->image->match_data.detail;
+
+  if (!*bucket)
+    *bucket = g_new0 (ImageBucket, 1);
+
+  if (!detail)
+    (*bucket)->plain = entries_append ((*bucket)->plain, entry);
+  else if (detail[0] == '*')
+    suffix_node_insert (&(*bucket)->suffixes, detail + 1, entry);
+  else
+    {
+      GArray *entries;
+
+      if (!(*bucket)->details)
+        (*bucket)->details = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                    NULL, (GDestroyNotify) entries_free);
+
+      /* the details are interned by the parser */
+      entries = g_hash_table_lookup ((*bucket)->details, detail);
+      if (entries)
+        entries_append (entries, entry);
+      else
+        g_hash_table_insert ((*bucket)->details, (gpointer) detail,
+                             entries_append (NULL, entry));
+    }
+}
+
+ThemeImageIndex *
+theme_image_index_new (GList *img_list)
+{
+  ThemeImageIndex *index = g_new0 (ThemeImageIndex, 1);
+  IndexEntry       entry;
+  guint            i;
+
+  for (entry.order = 0; img_list; img_list = img_list->next, entry.order++)
+    {
+      guint function, state;
+
+      entry.image = img_list->data;
+
+      /* an image without a valid function never matches */
+      if (entry.image->match_data.function < TOKEN_D_HLINE ||
+          entry.image->match_data.function > TOKEN_D_STEPPER)
+        continue;
+
+      function = entry.image->match_data.function - TOKEN_D_HLINE;
+      index->functions |= 1 << function;
+
+      if (entry.image->match_data.flags & THEME_MATCH_STATE)
+        theme_image_index_add (index, function, entry.image->match_data.state, &entry);
+      else
+        for (state = 0; state < N_STATE_SLOTS; state++)
+          theme_image_index_add (index, function, state, &entry);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (index->buckets); i++)
+    if (index->buckets[i] && index->buckets[i]->suffixes)
+      suffix_node_finish (index->buckets[i]->suffixes, NULL);
+
+  return index;
+}
+
+void
+theme_image_index_free (ThemeImageIndex *index)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (index->buckets); i++)
+    {
+      ImageBucket *bucket = index->buckets[i];
+
+      if (!bucket)
+        continue;
+
+      entries_free (bucket->plain);
+      suffix_node_free (bucket->suffixes);
+      if (bucket->details)
+        g_hash_table_destroy (bucket->details);
+      g_free (bucket);
+    }
+
+  g_free (index);
+}
+
+/* everything but the function and the detail */
+static gboolean
+theme_image_matches (ThemeImage     *image,
+                     ThemeMatchData *match_data)
+{
+  guint flags = match_data->flags & image->match_data.flags;
+
+  if (flags != image->match_data.flags) /* Required components not present */
+    return FALSE;
+
+  if ((flags & THEME_MATCH_STATE) &&
+      match_data->state != image->match_data.state)
+    return FALSE;
+
+  if ((flags & THEME_MATCH_POSITION) &&
+      match_data->position != image->match_data.position)
+    return FALSE;
+
+  if ((flags & THEME_MATCH_SHADOW) &&
+      match_data->shadow != image->match_data.shadow)
+    return FALSE;
+
+  if ((flags & THEME_MATCH_ARROW_DIRECTION) &&
+      match_data->arrow_direction != image->match_data.arrow_direction)
+    return FALSE;
+
+  if ((flags & THEME_MATCH_ORIENTATION) &&
+      match_data->orientation != image->match_data.orientation)
+    return FALSE;
+
+  if ((flags & THEME_MATCH_GAP_SIDE) &&
+      match_data->gap_side != image->match_data.gap_side)
+    return FALSE;
+
+  return TRUE;
+}
+
+ThemeImage *
+theme_image_index_match (ThemeImageIndex *index,
+                         ThemeMatchData  *match_data)
+{
+  ImageBucket  *bucket;
+  const GArray *lists[3];
+  guint        pos[3] = { 0, 0, 0 };
+  guint        function, state;
+
+  if (match_data->function < TOKEN_D_HLINE ||
+      match_data->function > TOKEN_D_STEPPER)
+    return NULL;
+
+  function = match_data->function - TOKEN_D_HLINE;
+  if (!(index->functions & (1 << function)))
+    return NULL;
+
+  state = match_data->flags & THEME_MATCH_STATE ? match_data->state : STATE_NONE;
+  bucket = index->buckets[function * N_STATE_SLOTS + state];
+  if (!bucket)
+    return NULL;
+
+  /* the images without a detail, with this detail, and with a wildcard
+   * detail matching it; merged in the order of the list, so the first match
+   * wins */
+  lists[0] = bucket->plain;
+  lists[1] = NULL;
+  lists[2] = NULL;
+
+  if (match_data->detail)
+    {
+      if (bucket->details)
+        {
+          /* a detail that was never interned is not in any gtkrc */
+          GQuark quark = g_quark_try_string (match_data->detail);
+
+          if (quark)
+            lists[1] = g_hash_table_lookup (bucket->details,
+                                            g_quark_to_string (quark));
+        }
+      /* simple pattern matching for (treeview) details
+       * in gtkrc 'detail = "*_start"' will match all calls with detail ending
+       * with '_start' such as 'cell_even_start', 'cell_odd_start', etc.
+       */
+      if (bucket->suffixes)
+        lists[2] = suffix_node_lookup (bucket->suffixes, match_data->detail);
+    }
+
+  for (;;)
+    {
+      IndexEntry *entry = NULL;
+      guint       i, list = 0;
+
+      for (i = 0; i < G_N_ELEMENTS (lists); i++)
+        if (lists[i] && pos[i] < lists[i]->len)
+          {
+            IndexEntry *head = &g_array_index (lists[i], IndexEntry, pos[i]);
+
+            if (!entry || head->order < entry->order)
+              {
+                entry = head;
+                list = i;
+              }
+          }
+
+      if (!entry)
+        return NULL;
+
+      pos[list]++;
+
+      if (theme_image_matches (entry->image, match_data))
+        return entry->image;
+    }
+}
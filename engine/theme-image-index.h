@@ -0,0 +1,42 @@
+/* GTK+ Sapwood Engine
+ * Copyright (C) 2005 Nokia Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __THEME_IMAGE_INDEX_H__
+#define __THEME_IMAGE_INDEX_H__
+
+#include "theme-pixbuf.h"
+
+G_BEGIN_DECLS
+
+/* The ThemeImages of a style bucketed by function and state, and by detail
+ * within these, for finding the first image of the list that matches a
+ * paint call without looking at all of them.
+ */
+typedef struct _ThemeImageIndex ThemeImageIndex;
+
+ThemeImageIndex *theme_image_index_new   (GList           *img_list) G_GNUC_INTERNAL;
+void             theme_image_index_free  (ThemeImageIndex *index) G_GNUC_INTERNAL;
+
+/* the first image of the list @index was built from matching @match_data */
+ThemeImage      *theme_image_index_match (ThemeImageIndex *index,
+                                          ThemeMatchData  *match_data) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* __THEME_IMAGE_INDEX_H__ */
@@ -39,6 +39,7 @@
 #endif
 
 static GHashTable *pixbuf_hash = NULL;
+static GHashTable *pending_hash = NULL; /* ThemePixbuf -> sequence number */
 
 ThemePixbuf *
 theme_pixbuf_new (void)
@@ -58,11 +59,17 @@ theme_pixbuf_destroy (ThemePixbuf *theme_pb)
   else if (theme_pb->refcnt > 1)
       g_warning ("[%p] destroy: refcnt > 1", theme_pb);
 
+  /* a late reply will find it gone and free the pixmap */
+  if (pending_hash)
+    g_hash_table_remove (pending_hash, theme_pb);
+
   if (theme_pb->shared)
     {
       g_hash_table_remove (pixbuf_hash, theme_pb);
       if (theme_pb->pixmap)
 	sapwood_pixmap_free (theme_pb->pixmap);
+      if (theme_pb->variant)
+	sapwood_pixmap_free (theme_pb->variant);
     }
   if (theme_pb->basename)
     g_free (theme_pb->basename);
@@ -91,7 +98,9 @@ static guint
 theme_pixbuf_hash (gconstpointer v)
 {
   const ThemePixbuf *theme_pb = v;
-  return (uintptr_t)theme_pb->dirname ^ g_str_hash (theme_pb->basename);
+  return (uintptr_t)theme_pb->dirname ^ g_str_hash (theme_pb->basename) ^
+	 (theme_pb->border_left | theme_pb->border_right << 8 |
+	  theme_pb->border_top << 16 | theme_pb->border_bottom << 24);
 }
 
 static gboolean
@@ -102,22 +111,26 @@ theme_pixbuf_equal (gconstpointer v1,
   const ThemePixbuf *b = v2;
 
   if (a->dirname != b->dirname ||
+      a->border_left   != b->border_left ||
+      a->border_right  != b->border_right ||
+      a->border_top    != b->border_top ||
+      a->border_bottom != b->border_bottom ||
+      a->stretch       != b->stretch ||
       !g_str_equal (a->basename, b->basename))
     return FALSE;
 
   return TRUE;
 }
 
+/* shares the ThemePixbufs using the same file with the same borders and
+ * stretching, the server slices a file only once for each border set */
 ThemePixbuf *
-theme_pixbuf_canonicalize (ThemePixbuf *theme_pb,
-                           gboolean    *warn)
+theme_pixbuf_canonicalize (ThemePixbuf *theme_pb)
 {
   ThemePixbuf *canon;
 
   g_assert (theme_pb->pixmap == NULL);
 
-  *warn = FALSE;
-
   if (!pixbuf_hash)
     pixbuf_hash = g_hash_table_new (theme_pixbuf_hash, theme_pixbuf_equal);
 
@@ -130,13 +143,6 @@ theme_pixbuf_canonicalize (ThemePixbuf *theme_pb,
     }
   else
     {
-      if (theme_pb->border_bottom != canon->border_bottom ||
-          theme_pb->border_top    != canon->border_top ||
-          theme_pb->border_left   != canon->border_left ||
-          theme_pb->border_right  != canon->border_right ||
-          theme_pb->stretch       != canon->stretch)
-        *warn = TRUE;
-
       theme_pixbuf_ref (canon);
       theme_pixbuf_unref (theme_pb);
     }
@@ -205,6 +211,24 @@ theme_pixbuf_set_filename (ThemePixbuf *theme_pb,
     }
 }
 
+/* like theme_pixbuf_set_filename() for a file resolved already, with an
+ * interned @dirname */
+void
+theme_pixbuf_set_path (ThemePixbuf *theme_pb,
+		       const char  *dirname,
+		       const char  *basename)
+{
+  g_assert (theme_pb->pixmap == NULL);
+
+  if (theme_pb->basename)
+    g_free (theme_pb->basename);
+
+  theme_pb->dirname  = dirname;
+  theme_pb->basename = g_strdup (basename);
+
+  theme_pixbuf_check_borders (theme_pb);
+}
+
 void
 theme_pixbuf_set_border (ThemePixbuf *theme_pb,
 			 gint         left,
@@ -234,6 +258,24 @@ theme_pixbuf_set_stretch (ThemePixbuf *theme_pb,
 static SapwoodPixmap *
 theme_pixbuf_get_pixmap (ThemePixbuf *theme_pb)
 {
+  guint32 seq = 0;
+
+  if (pending_hash)
+    seq = GPOINTER_TO_UINT (g_hash_table_lookup (pending_hash, theme_pb));
+
+  if (seq)
+    {
+      GError *err = NULL;
+
+      /* collect the prefetched pixmap, on failure retry below to report the
+       * error */
+      if (!sapwood_pixmap_wait (seq, &err))
+	{
+	  LOG ("prefetch failed: %s", err->message);
+	  g_error_free (err);
+	}
+    }
+
   if (!theme_pb->pixmap)
     {
       char   *filename;
@@ -258,6 +300,130 @@ theme_pixbuf_get_pixmap (ThemePixbuf *theme_pb)
   return theme_pb->pixmap;
 }
 
+/* the pixmaps for drawables of another @depth than the screen, which only
+ * the ARGB windows of a few applications have, so one variant is kept */
+static SapwoodPixmap *
+theme_pixbuf_get_variant (ThemePixbuf *theme_pb,
+			  gint         depth)
+{
+  char   *filename;
+  GError *err = NULL;
+
+  if (theme_pb->variant_depth == depth)
+    return theme_pb->variant;
+
+  if (theme_pb->variant)
+    sapwood_pixmap_free (theme_pb->variant);
+
+  /* not retried on failure */
+  theme_pb->variant_depth = depth;
+
+  filename = g_build_filename (theme_pb->dirname, theme_pb->basename, NULL);
+  theme_pb->variant = sapwood_pixmap_get_for_file_at_depth (filename,
+							    theme_pb->border_left,
+							    theme_pb->border_right,
+							    theme_pb->border_top,
+							    theme_pb->border_bottom,
+							    depth,
+							    &err);
+  if (!theme_pb->variant)
+    {
+      g_warning ("sapwood-theme: Failed to load pixmap file %s at depth %d: %s\n",
+		 filename, depth, err->message);
+      g_error_free (err);
+    }
+
+  g_free (filename);
+
+  return theme_pb->variant;
+}
+
+static void
+theme_pixbuf_prefetch_done (SapwoodPixmap *pixmap,
+                            guint32        seq,
+                            gpointer       user_data)
+{
+  ThemePixbuf *theme_pb = user_data;
+
+  /* the pixbuf may have been destroyed or prefetched again in the meantime */
+  if (GPOINTER_TO_UINT (g_hash_table_lookup (pending_hash, theme_pb)) != seq)
+    {
+      if (pixmap)
+	sapwood_pixmap_free (pixmap);
+      return;
+    }
+
+  g_hash_table_remove (pending_hash, theme_pb);
+
+  if (theme_pb->pixmap)
+    {
+      if (pixmap)
+	sapwood_pixmap_free (pixmap);
+    }
+  else
+    theme_pb->pixmap = pixmap;
+}
+
+/* Start loading the pixmaps for all not yet loaded @pixbufs in one go
+ * instead of one server round trip for each when they are first painted.
+ * The replies are collected from the main loop, or by
+ * theme_pixbuf_get_pixmap() if they are needed before that.
+ */
+void
+theme_pixbuf_prefetch (GPtrArray *pixbufs)
+{
+  SapwoodPixmapRequest *requests;
+  GHashTable           *seen;
+  GError               *err = NULL;
+  guint                 i, n;
+
+  if (!pending_hash)
+    pending_hash = g_hash_table_new (NULL, NULL);
+
+  requests = g_new0 (SapwoodPixmapRequest, pixbufs->len);
+  seen = g_hash_table_new (NULL, NULL);
+
+  for (i = 0, n = 0; i < pixbufs->len; i++)
+    {
+      ThemePixbuf *theme_pb = g_ptr_array_index (pixbufs, i);
+
+      if (theme_pb->pixmap || !theme_pb->basename ||
+          g_hash_table_lookup (pending_hash, theme_pb) ||
+          g_hash_table_lookup (seen, theme_pb))
+	continue;
+
+      g_hash_table_insert (seen, theme_pb, theme_pb);
+
+      requests[n].filename      = g_build_filename (theme_pb->dirname, theme_pb->basename, NULL);
+      requests[n].border_left   = theme_pb->border_left;
+      requests[n].border_right  = theme_pb->border_right;
+      requests[n].border_top    = theme_pb->border_top;
+      requests[n].border_bottom = theme_pb->border_bottom;
+      requests[n].user_data     = theme_pb;
+      n++;
+    }
+
+  LOG ("prefetching %d of %d pixbufs", n, pixbufs->len);
+
+  if (n && !sapwood_pixmap_open_async (requests, n, theme_pixbuf_prefetch_done, &err))
+    {
+      /* the pixmaps will be loaded (and errors reported) on demand */
+      LOG ("prefetch failed: %s", err->message);
+      g_error_free (err);
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (requests[i].seq)
+	g_hash_table_insert (pending_hash, requests[i].user_data,
+			     GUINT_TO_POINTER (requests[i].seq));
+      g_free ((char *) requests[i].filename);
+    }
+
+  g_hash_table_destroy (seen);
+  g_free (requests);
+}
+
 gboolean
 theme_pixbuf_get_geometry (ThemePixbuf *theme_pb,
 			   gint        *width,
@@ -307,6 +473,14 @@ theme_pixbuf_render (ThemePixbuf  *theme_pb,
 
   pixmap = theme_pixbuf_get_pixmap (theme_pb);
 
+  /* the pixmaps can only be drawn to drawables of the same depth */
+  if (sapwood_pixmap_get_depth (pixmap) != gdk_drawable_get_depth (window))
+    {
+      pixmap = theme_pixbuf_get_variant (theme_pb, gdk_drawable_get_depth (window));
+      if (!pixmap)
+	return FALSE;
+    }
+
   if (theme_pb->stretch)
     {
       /* if we do scaling we want to draw at least the whole pixmap */
@@ -327,8 +501,7 @@ theme_pixbuf_render (ThemePixbuf  *theme_pb,
 	component_mask = (COMPONENT_ALL - 1) & ~component_mask;
 
 #define RENDER_COMPONENT(X,Y) do {			           \
-    sapwood_pixmap_get_pixmap (pixmap, X, Y, &rect[n_rect].pixmap, \
-			       &rect[n_rect].pixmask);	           \
+    sapwood_pixmap_get_rect (pixmap, X, Y, &rect[n_rect]);	   \
 							           \
     rect[n_rect].dest.x = dest_x[X];			           \
     rect[n_rect].dest.y = dest_y[Y];			           \
@@ -426,8 +599,7 @@ theme_pixbuf_render (ThemePixbuf  *theme_pb,
       x += (width - draw_width) / 2;
       y += (height - draw_height) / 2;
 
-      sapwood_pixmap_get_pixmap (pixmap, 1, 1,
-                                 &rect[0].pixmap, &rect[0].pixmask);
+      sapwood_pixmap_get_rect (pixmap, 1, 1, &rect[0]);
       rect[0].dest.x = x;
       rect[0].dest.y = y;
       rect[0].dest.width = pixbuf_width;
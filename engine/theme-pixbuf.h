@@ -22,6 +22,9 @@
  * Carsten Haitzler <raster@rasterman.com>
  */
 
+#ifndef __THEME_PIXBUF_H__
+#define __THEME_PIXBUF_H__
+
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include "sapwood-pixmap.h"
@@ -139,6 +142,8 @@ struct _ThemePixbuf
   gchar      *basename;
 
   SapwoodPixmap *pixmap;
+  SapwoodPixmap *variant;       /* in variant_depth, for other drawables */
+  guint8      variant_depth;
 
   guint16     border_left;
   guint16     border_right;
@@ -151,7 +156,7 @@ struct _ThemePixbuf
 
 struct _ThemeMatchData
 {
-  gchar          *detail;
+  const gchar    *detail;		/* interned */
   guint16         function;	/* Mandatory */
 
   ThemeMatchFlags flags           : 6;
@@ -180,10 +185,12 @@ struct _ThemeImage
 
 ThemePixbuf *theme_pixbuf_new          (void) G_GNUC_INTERNAL;
 void         theme_pixbuf_unref        (ThemePixbuf  *theme_pb) G_GNUC_INTERNAL;
-ThemePixbuf *theme_pixbuf_canonicalize (ThemePixbuf  *theme_pb,
-                                        gboolean     *warn) G_GNUC_INTERNAL;
+ThemePixbuf *theme_pixbuf_canonicalize (ThemePixbuf  *theme_pb) G_GNUC_INTERNAL;
 void         theme_pixbuf_set_filename (ThemePixbuf  *theme_pb,
 					const char   *filename) G_GNUC_INTERNAL;
+void         theme_pixbuf_set_path     (ThemePixbuf  *theme_pb,
+					const char   *dirname,
+					const char   *basename) G_GNUC_INTERNAL;
 gboolean     theme_pixbuf_get_geometry (ThemePixbuf  *theme_pb,
 					gint         *width,
 					gint         *height) G_GNUC_INTERNAL;
@@ -194,6 +201,7 @@ void         theme_pixbuf_set_border   (ThemePixbuf  *theme_pb,
 					gint          bottom) G_GNUC_INTERNAL;
 void         theme_pixbuf_set_stretch  (ThemePixbuf  *theme_pb,
 					gboolean      stretch) G_GNUC_INTERNAL;
+void         theme_pixbuf_prefetch     (GPtrArray    *pixbufs) G_GNUC_INTERNAL;
 gboolean     theme_pixbuf_render       (ThemePixbuf  *theme_pb,
 					GtkWidget    *widget,
 					GdkWindow    *window,
@@ -208,3 +216,5 @@ gboolean     theme_pixbuf_render       (ThemePixbuf  *theme_pb,
 
 
 extern GtkStyleClass pixmap_default_class G_GNUC_INTERNAL;
+
+#endif /* __THEME_PIXBUF_H__ */
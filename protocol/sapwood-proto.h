@@ -26,16 +26,33 @@
 
 G_BEGIN_DECLS
 
-#define PIXBUF_OP_OPEN  1
-#define PIXBUF_OP_CLOSE 2
+#define PIXBUF_OP_OPEN       1
+#define PIXBUF_OP_CLOSE      2
+#define PIXBUF_OP_OPEN_BATCH 3
+#define PIXBUF_OP_STATS      4
+
+/* maximum number of images in a single PixbufOpenBatchRequest */
+#define PIXBUF_OPEN_BATCH_MAX 64
+
+/* batched open requests are padded to keep the next one aligned */
+#define PIXBUF_PROTO_ALIGN(len) (((len) + 3) & ~3)
 
 typedef struct
 {
   guint8  op;
   guint8  _pad1;
   guint16 length;
+  guint32 seq;                  /* chosen by the client, echoed in the reply */
 } PixbufBaseRequest;
 
+/* every reply starts with this header, replies to different requests may be
+ * pipelined but are never interleaved */
+typedef struct
+{
+  guint32 seq;                  /* seq of the request this is the reply to */
+  guint32 length;               /* including this header */
+} PixbufBaseResponse;
+
 typedef struct
 {
   PixbufBaseRequest base;
@@ -43,6 +60,7 @@ typedef struct
   guint16 border_right;
   guint16 border_top;
   guint16 border_bottom;
+  guint16 depth;                /* of the pixmaps, 0 for the screen's */
   gchar   filename[0];          /* null terminated, absolute filename */
 } PixbufOpenRequest;
 
@@ -52,6 +70,16 @@ typedef struct
   guint32 id;
 } PixbufCloseRequest;
 
+typedef struct
+{
+  PixbufBaseRequest base;
+  guint16 n_requests;           /* at most PIXBUF_OPEN_BATCH_MAX */
+  guint16 _pad1;
+  /* followed by n_requests PixbufOpenRequests, each starting at a
+   * PIXBUF_PROTO_ALIGN()ed offset; the reply carries n_requests
+   * PixbufOpenResponses, with id == 0 for the images that failed */
+} PixbufOpenBatchRequest;
+
 typedef struct
 {
   guint32 id;
@@ -59,8 +87,59 @@ typedef struct
   guint16 height;
   guint32 pixmap[3][3];         /* XIDs for pixmaps and masks for each part */
   guint32 pixmask[3][3];        /* 0 if not applicable (full opacity)       */
+  guint16 tile_width[3][3];     /* geometry of the pixmaps and masks, so that */
+  guint16 tile_height[3][3];    /* the client can import them without asking */
+  guint8  depth;                /* as requested; masks have a depth of 1     */
+  guint8  _pad1;
+  guint16 solid;                /* bit i * 3 + j set if part [i][j] is an
+                                   opaque color, with no pixmap or mask */
+  guint32 color[3][3];          /* pixel values of the solid parts */
+  guint16 tile_x[3][3];         /* position of the parts in an atlas, where */
+  guint16 tile_y[3][3];         /* all parts share one pixmap and mask, the  */
+  guint16 atlas_width;          /* parts that are tiled are repeated, 0 if   */
+  guint16 atlas_height;         /* every part has its own pixmap             */
 } PixbufOpenResponse;
 
+#define PIXBUF_OPEN_RESPONSE_SOLID(rep,i,j) (((rep)->solid >> ((i) * 3 + (j))) & 1)
+
+typedef struct
+{
+  PixbufBaseRequest base;
+} PixbufStatsRequest;
+
+typedef struct
+{
+  guint32 n_clients;
+  guint32 n_images;
+  guint32 hits;                 /* opens of images that were loaded */
+  guint32 misses;               /* opens that had to load the image */
+  guint32 revived;              /* opens of unused, retained images */
+  guint32 _pad1;
+  guint64 decode_usec;          /* total time spent decoding images */
+  guint64 upload_usec;          /* total time spent uploading them */
+  guint64 pixmap_bytes;         /* X server memory used by all images */
+  guint64 retained_bytes;       /* of which by unused images */
+  /* followed by n_clients PixbufStatsClients and n_images
+   * PixbufStatsImages */
+} PixbufStatsResponse;
+
+typedef struct
+{
+  guint32 pid;                  /* 0 if unknown */
+  guint32 n_opens;              /* images requested so far */
+  guint32 n_images;             /* images currently open */
+  guint32 n_refs;               /* references to them */
+} PixbufStatsClient;
+
+typedef struct
+{
+  guint16 length;               /* of this record, PIXBUF_PROTO_ALIGN()ed */
+  guint16 _pad1;
+  guint32 refcnt;               /* 0 for retained images */
+  guint32 bytes;                /* X server memory used by the image */
+  gchar   filename[0];          /* null terminated */
+} PixbufStatsImage;
+
 G_CONST_RETURN char *sapwood_socket_path_get_default (void) G_GNUC_INTERNAL;
 G_CONST_RETURN char *sapwood_socket_path_get_for_display (GdkDisplay *display) G_GNUC_INTERNAL;
 
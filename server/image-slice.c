@@ -0,0 +1,41 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <config.h>
+
+#include "image-slice.h"
+
+void
+image_slice_bounds (gint width,
+                    gint height,
+                    gint border_left,
+                    gint border_right,
+                    gint border_top,
+                    gint border_bottom,
+                    gint bounds_x[4],
+                    gint bounds_y[4])
+{
+  bounds_x[0] = 0;
+  bounds_x[1] = CLAMP (border_left, 0, width);
+  bounds_x[2] = CLAMP (width - border_right, 0, width);
+  bounds_x[3] = width;
+  bounds_y[0] = 0;
+  bounds_y[1] = CLAMP (border_top, 0, height);
+  bounds_y[2] = CLAMP (height - border_bottom, 0, height);
+  bounds_y[3] = height;
+}
@@ -0,0 +1,42 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef IMAGE_SLICE_H
+#define IMAGE_SLICE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The edges of the 3x3 parts of a @width x @height image sliced by the
+ * borders: part [i][j] spans @bounds_x[j] to @bounds_x[j + 1] and
+ * @bounds_y[i] to @bounds_y[i + 1], and is empty when these are not
+ * increasing. The edges are clamped to the image, so borders that do not
+ * fit never give a part outside of it. */
+void image_slice_bounds (gint width,
+                         gint height,
+                         gint border_left,
+                         gint border_right,
+                         gint border_top,
+                         gint border_bottom,
+                         gint bounds_x[4],
+                         gint bounds_y[4]);
+
+G_END_DECLS
+
+#endif /* !IMAGE_SLICE_H */
@@ -0,0 +1,93 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include "config.h"
+
+#include "pixbuf-decode.h"
+
+cairo_surface_t *
+pixbuf_to_surface (GdkPixbuf *pixbuf)
+{
+  gint             width      = gdk_pixbuf_get_width (pixbuf);
+  gint             height     = gdk_pixbuf_get_height (pixbuf);
+  gint             n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint             src_stride = gdk_pixbuf_get_rowstride (pixbuf);
+  const guchar    *src        = gdk_pixbuf_get_pixels (pixbuf);
+  cairo_surface_t *surface;
+  guchar          *dst;
+  gint             dst_stride;
+  gint             x, y;
+
+  surface = cairo_image_surface_create (n_channels == 4 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+					width, height);
+  dst        = cairo_image_surface_get_data (surface);
+  dst_stride = cairo_image_surface_get_stride (surface);
+
+  for (y = 0; y < height; y++)
+    {
+      const guchar *p = src + y * src_stride;
+      guint32      *q = (guint32 *) (dst + y * dst_stride);
+
+      for (x = 0; x < width; x++, p += n_channels)
+	{
+	  guint a = n_channels == 4 ? p[3] : 0xff;
+	  guint r = p[0], g = p[1], b = p[2];
+
+	  if (a != 0xff)
+	    {
+	      /* premultiply, rounding like cairo does */
+	      guint t;
+
+	      t = r * a + 0x80; r = (t + (t >> 8)) >> 8;
+	      t = g * a + 0x80; g = (t + (t >> 8)) >> 8;
+	      t = b * a + 0x80; b = (t + (t >> 8)) >> 8;
+	    }
+
+	  q[x] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+gchar *
+pixbuf_digest (GdkPixbuf *pixbuf)
+{
+  gint       width      = gdk_pixbuf_get_width (pixbuf);
+  gint       height     = gdk_pixbuf_get_height (pixbuf);
+  gint       n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint       stride     = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar    *pixels     = gdk_pixbuf_get_pixels (pixbuf);
+  GChecksum *checksum   = g_checksum_new (G_CHECKSUM_SHA1);
+  gchar     *digest;
+  gint       geometry[3] = { width, height, n_channels };
+  gint       y;
+
+  g_checksum_update (checksum, (const guchar *) geometry, sizeof (geometry));
+
+  /* without the padding at the end of the rows */
+  for (y = 0; y < height; y++)
+    g_checksum_update (checksum, pixels + y * stride, width * n_channels);
+
+  digest = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return digest;
+}
@@ -0,0 +1,41 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef PIXBUF_DECODE_H
+#define PIXBUF_DECODE_H
+
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+/* Both are used from the worker threads of the server, so that only the
+ * upload to the X server has to be done by the main loop, and by
+ * sapwood-pack.
+ */
+
+/* the pixels of @pixbuf premultiplied, as ARGB32 if it has alpha and as
+ * RGB24 otherwise */
+cairo_surface_t *pixbuf_to_surface (GdkPixbuf *pixbuf);
+
+/* a SHA-1 of the geometry and the pixels of @pixbuf, themes often ship the
+ * same image under several names */
+gchar           *pixbuf_digest     (GdkPixbuf *pixbuf);
+
+G_END_DECLS
+
+#endif /* !PIXBUF_DECODE_H */
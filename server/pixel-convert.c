@@ -0,0 +1,203 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <config.h>
+
+#include "pixel-convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define RGB_BITS 0x00ffffff
+
+#if defined(__SSE2__)
+/* the bits of a nibble in reverse order */
+static const guint8 reverse_nibble[16] =
+{
+  0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+  0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+#endif
+
+void
+pixel_convert_row (const guint32 *src,
+                   guint32       *dst,
+                   guint8        *mask,
+                   gint           width)
+{
+  gint i = 0;
+
+  /* eight pixels at a time, a byte of the mask */
+#if defined(__SSE2__)
+  {
+    const __m128i rgb = _mm_set1_epi32 (RGB_BITS);
+
+    for (; i + 8 <= width; i += 8)
+      {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (src + i + 4));
+
+        if (dst)
+          {
+            _mm_storeu_si128 ((__m128i *) (dst + i), _mm_and_si128 (a, rgb));
+            _mm_storeu_si128 ((__m128i *) (dst + i + 4), _mm_and_si128 (b, rgb));
+          }
+
+        /* the sign bits are the alpha threshold, first pixel lowest */
+        if (mask)
+          mask[i / 8] = reverse_nibble[_mm_movemask_ps (_mm_castsi128_ps (a))] << 4 |
+                        reverse_nibble[_mm_movemask_ps (_mm_castsi128_ps (b))];
+      }
+  }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+  {
+    static const guint32 high[4] = { 0x80, 0x40, 0x20, 0x10 };
+    static const guint32 low[4]  = { 0x08, 0x04, 0x02, 0x01 };
+    const uint32x4_t     rgb     = vdupq_n_u32 (RGB_BITS);
+    const uint32x4_t     vhigh   = vld1q_u32 (high);
+    const uint32x4_t     vlow    = vld1q_u32 (low);
+
+    for (; i + 8 <= width; i += 8)
+      {
+        uint32x4_t a = vld1q_u32 (src + i);
+        uint32x4_t b = vld1q_u32 (src + i + 4);
+
+        if (dst)
+          {
+            vst1q_u32 (dst + i, vandq_u32 (a, rgb));
+            vst1q_u32 (dst + i + 4, vandq_u32 (b, rgb));
+          }
+
+        if (mask)
+          {
+            /* all ones for the pixels above the threshold */
+            uint32x4_t ma = vreinterpretq_u32_s32 (vshrq_n_s32 (vreinterpretq_s32_u32 (a), 31));
+            uint32x4_t mb = vreinterpretq_u32_s32 (vshrq_n_s32 (vreinterpretq_s32_u32 (b), 31));
+            uint32x4_t m  = vorrq_u32 (vandq_u32 (ma, vhigh), vandq_u32 (mb, vlow));
+            uint32x2_t s  = vorr_u32 (vget_low_u32 (m), vget_high_u32 (m));
+
+            mask[i / 8] = vget_lane_u32 (s, 0) | vget_lane_u32 (s, 1);
+          }
+      }
+  }
+#endif
+
+  for (; i < width; i++)
+    {
+      if (dst)
+        dst[i] = src[i] & RGB_BITS;
+
+      if (mask)
+        {
+          if (i % 8 == 0)
+            mask[i / 8] = 0;
+          if (src[i] & 0x80000000)
+            mask[i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+}
+
+/* 4x4 Bayer matrix, 0 to 15 */
+static const guint8 dither[4][4] =
+{
+  {  0,  8,  2, 10 },
+  { 12,  4, 14,  6 },
+  {  3, 11,  1,  9 },
+  { 15,  7, 13,  5 }
+};
+
+void
+pixel_convert_row_565 (const guint32 *src,
+                       guint16       *dst,
+                       guint8        *mask,
+                       gint           width,
+                       gint           y)
+{
+  const guint8 *d = dither[y & 3];
+  gint          i = 0;
+
+#if (defined(__ARM_NEON__) || defined(__ARM_NEON)) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+  /* eight pixels at a time, split into their bytes (blue, green, red and
+   * alpha in little endian ARGB32) */
+  {
+    static const guint8 bits[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    const guint8        d8[8]   = { d[0], d[1], d[2], d[3], d[0], d[1], d[2], d[3] };
+    const uint8x8_t     vbits   = vld1_u8 (bits);
+    const uint8x8_t     vd_rb   = vshr_n_u8 (vld1_u8 (d8), 1);
+    const uint8x8_t     vd_g    = vshr_n_u8 (vld1_u8 (d8), 2);
+
+    for (; i + 8 <= width; i += 8)
+      {
+        uint8x8x4_t p = vld4_u8 ((const guint8 *) (src + i));
+
+        if (dst)
+          {
+            /* the saturating add is the MIN() below; each channel is
+             * shifted to the top of a 16 bit lane and the next one
+             * inserted below its bits */
+            uint16x8_t r = vshll_n_u8 (vqadd_u8 (p.val[2], vd_rb), 8);
+            uint16x8_t g = vshll_n_u8 (vqadd_u8 (p.val[1], vd_g), 8);
+            uint16x8_t b = vshll_n_u8 (vqadd_u8 (p.val[0], vd_rb), 8);
+
+            r = vsriq_n_u16 (r, g, 5);
+            r = vsriq_n_u16 (r, b, 11);
+            vst1q_u16 (dst + i, r);
+          }
+
+        if (mask)
+          {
+            /* all ones for the pixels above the threshold, then one bit
+             * each, added up pairwise */
+            uint8x8_t m = vreinterpret_u8_s8 (vshr_n_s8 (vreinterpret_s8_u8 (p.val[3]), 7));
+
+            m = vand_u8 (m, vbits);
+            m = vpadd_u8 (m, m);
+            m = vpadd_u8 (m, m);
+            m = vpadd_u8 (m, m);
+            mask[i / 8] = vget_lane_u8 (m, 0);
+          }
+      }
+  }
+#endif
+
+  for (; i < width; i++)
+    {
+      guint32 p = src[i];
+
+      if (dst)
+        {
+          /* scaled to the step of 8 of red and blue, and 4 of green */
+          guint r = MIN (((p >> 16) & 0xff) + (d[i & 3] >> 1), 0xff);
+          guint g = MIN (((p >> 8) & 0xff) + (d[i & 3] >> 2), 0xff);
+          guint b = MIN ((p & 0xff) + (d[i & 3] >> 1), 0xff);
+
+          dst[i] = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+        }
+
+      if (mask)
+        {
+          if (i % 8 == 0)
+            mask[i / 8] = 0;
+          if (p & 0x80000000)
+            mask[i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Converts @width premultiplied ARGB32 pixels (as in a cairo image surface)
+ * to x8r8g8b8 pixels in @dst, which is what painting them over black gives,
+ * and packs the alpha threshold of 128 used for the masks into @mask, most
+ * significant bit first as in the bitmaps of gdk_image_new_bitmap(). Either
+ * of @dst and @mask may be %NULL.
+ */
+void pixel_convert_row (const guint32 *src,
+                        guint32       *dst,
+                        guint8        *mask,
+                        gint           width);
+
+/* Likewise for r5g6b5 pixels, with an ordered dither for row @y so that
+ * gradients do not band.
+ */
+void pixel_convert_row_565 (const guint32 *src,
+                            guint16       *dst,
+                            guint8        *mask,
+                            gint           width,
+                            gint           y);
+
+G_END_DECLS
+
+#endif /* !PIXEL_CONVERT_H */
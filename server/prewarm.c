@@ -0,0 +1,393 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include "config.h"
+
+#include "prewarm.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* how deep gtkrc include statements are followed */
+#define PREWARM_MAX_INCLUDE_DEPTH 8
+
+/* the image {} keys of sapwood-rc-style.c that name files and borders, the
+ * n-th file goes with the n-th border */
+static const struct
+{
+  const char *file;
+  const char *border;
+} image_keys[] =
+{
+  { "file",           "border" },
+  { "overlay_file",   "overlay_border" },
+  { "gap_file",       "gap_border" },
+  { "gap_start_file", "gap_start_border" },
+  { "gap_end_file",   "gap_end_border" },
+};
+
+enum
+{
+  TOKEN_IMAGE = G_TOKEN_LAST + 1,
+  TOKEN_INCLUDE,
+  TOKEN_PIXMAP_PATH,
+  TOKEN_FILE,                   /* + index into image_keys */
+  TOKEN_BORDER = TOKEN_FILE + G_N_ELEMENTS (image_keys)
+};
+
+/* the filenames are resolved like the engine resolves them, so that the
+ * requests of the engine find the prewarmed images */
+static void
+prewarm_add (GPtrArray  *requests,
+             const char *filename,
+             gint        border_left,
+             gint        border_right,
+             gint        border_top,
+             gint        border_bottom)
+{
+  PixbufOpenRequest *req;
+  char               abspath[PATH_MAX + 1];
+  gsize              len;
+
+  if (border_left < 0 || border_right < 0 || border_top < 0 || border_bottom < 0 ||
+      border_left > G_MAXUINT16 || border_right > G_MAXUINT16 ||
+      border_top > G_MAXUINT16 || border_bottom > G_MAXUINT16)
+    {
+      g_warning ("%s: invalid borders", filename);
+      return;
+    }
+
+  if (strlen (filename) > PATH_MAX || !realpath (filename, abspath))
+    {
+      g_warning ("%s: %s", filename,
+                 strlen (filename) > PATH_MAX ? "filename too long" : g_strerror (errno));
+      return;
+    }
+
+  len = strlen (abspath);
+
+  req = g_malloc0 (sizeof (PixbufOpenRequest) + len + 1);
+  req->base.op       = PIXBUF_OP_OPEN;
+  req->base.length   = sizeof (PixbufOpenRequest) + len + 1;
+  req->border_left   = border_left;
+  req->border_right  = border_right;
+  req->border_top    = border_top;
+  req->border_bottom = border_bottom;
+  memcpy (req->filename, abspath, len + 1);
+
+  g_ptr_array_add (requests, req);
+}
+
+/* The manifest lists one image per line, as an absolute filename or one
+ * relative to the manifest, optionally followed by the left, right, top and
+ * bottom borders. Empty lines and lines starting with '#' are ignored.
+ */
+gboolean
+prewarm_parse_manifest (const char  *filename,
+                        GPtrArray   *requests,
+                        GError     **err)
+{
+  char  *contents;
+  char **lines;
+  char  *dirname;
+  int    i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, err))
+    return FALSE;
+
+  dirname = g_path_get_dirname (filename);
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++)
+    {
+      char *line = g_strstrip (lines[i]);
+      char  path[PATH_MAX + 1];
+      int   left = 0, right = 0, top = 0, bottom = 0;
+      int   n;
+
+      if (!*line || *line == '#')
+	continue;
+
+      n = sscanf (line, "%" G_STRINGIFY (PATH_MAX) "s %d %d %d %d",
+		  path, &left, &right, &top, &bottom);
+      if (n != 1 && n != 5)
+	{
+	  g_warning ("%s:%d: expected a filename and optionally four borders",
+		     filename, i + 1);
+	  continue;
+	}
+
+      if (g_path_is_absolute (path))
+	prewarm_add (requests, path, left, right, top, bottom);
+      else
+	{
+	  char *abs = g_build_filename (dirname, path, NULL);
+
+	  prewarm_add (requests, abs, left, right, top, bottom);
+	  g_free (abs);
+	}
+    }
+
+  g_strfreev (lines);
+  g_free (dirname);
+  g_free (contents);
+
+  return TRUE;
+}
+
+/* like gtk_rc_find_pixmap_in_path(): the pixmap_path first, then the
+ * directory of the gtkrc */
+static char *
+prewarm_find_pixmap (GPtrArray  *pixmap_path,
+                     const char *dirname,
+                     const char *name)
+{
+  char *filename;
+  guint i;
+
+  if (g_path_is_absolute (name))
+    return g_file_test (name, G_FILE_TEST_EXISTS) ? g_strdup (name) : NULL;
+
+  for (i = 0; i < pixmap_path->len; i++)
+    {
+      filename = g_build_filename (g_ptr_array_index (pixmap_path, i), name, NULL);
+      if (g_file_test (filename, G_FILE_TEST_EXISTS))
+	return filename;
+      g_free (filename);
+    }
+
+  filename = g_build_filename (dirname, name, NULL);
+  if (g_file_test (filename, G_FILE_TEST_EXISTS))
+    return filename;
+  g_free (filename);
+
+  return NULL;
+}
+
+static guint
+prewarm_parse_border (GScanner *scanner,
+                      gint      border[4])
+{
+  int i;
+
+  if (g_scanner_get_next_token (scanner) != G_TOKEN_EQUAL_SIGN)
+    return G_TOKEN_EQUAL_SIGN;
+
+  if (g_scanner_get_next_token (scanner) != G_TOKEN_LEFT_CURLY)
+    return G_TOKEN_LEFT_CURLY;
+
+  for (i = 0; i < 4; i++)
+    {
+      if (i > 0 && g_scanner_get_next_token (scanner) != G_TOKEN_COMMA)
+	return G_TOKEN_COMMA;
+
+      if (g_scanner_get_next_token (scanner) != G_TOKEN_INT)
+	return G_TOKEN_INT;
+      border[i] = scanner->value.v_int;
+    }
+
+  if (g_scanner_get_next_token (scanner) != G_TOKEN_RIGHT_CURLY)
+    return G_TOKEN_RIGHT_CURLY;
+
+  return G_TOKEN_NONE;
+}
+
+/* collects the files of one image {} block, anything but the file and
+ * border keys is skipped */
+static guint
+prewarm_parse_image (GScanner   *scanner,
+                     GPtrArray  *pixmap_path,
+                     const char *dirname,
+                     GPtrArray  *requests)
+{
+  char  *files[G_N_ELEMENTS (image_keys)] = { NULL, };
+  gint   borders[G_N_ELEMENTS (image_keys)][4] = { { 0, }, };
+  guint  token, expected = G_TOKEN_NONE;
+  int    depth = 1;
+  guint  i;
+
+  if (g_scanner_get_next_token (scanner) != G_TOKEN_LEFT_CURLY)
+    return G_TOKEN_LEFT_CURLY;
+
+  while (depth > 0 && expected == G_TOKEN_NONE)
+    {
+      token = g_scanner_get_next_token (scanner);
+
+      if (token == G_TOKEN_EOF)
+	expected = G_TOKEN_RIGHT_CURLY;
+      else if (token == G_TOKEN_LEFT_CURLY)
+	depth++;
+      else if (token == G_TOKEN_RIGHT_CURLY)
+	depth--;
+      else if (token >= TOKEN_FILE && token < TOKEN_BORDER)
+	{
+	  i = token - TOKEN_FILE;
+
+	  if (g_scanner_get_next_token (scanner) != G_TOKEN_EQUAL_SIGN)
+	    expected = G_TOKEN_EQUAL_SIGN;
+	  else if (g_scanner_get_next_token (scanner) != G_TOKEN_STRING)
+	    expected = G_TOKEN_STRING;
+	  else
+	    {
+	      g_free (files[i]);
+	      files[i] = prewarm_find_pixmap (pixmap_path, dirname,
+					      scanner->value.v_string);
+	      if (!files[i])
+		g_scanner_warn (scanner, "unable to locate image file in pixmap_path: \"%s\"",
+				scanner->value.v_string);
+	    }
+	}
+      else if (token >= TOKEN_BORDER && token < TOKEN_BORDER + G_N_ELEMENTS (image_keys))
+	expected = prewarm_parse_border (scanner, borders[token - TOKEN_BORDER]);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (image_keys); i++)
+    if (files[i])
+      {
+	if (expected == G_TOKEN_NONE)
+	  prewarm_add (requests, files[i],
+		       borders[i][0], borders[i][1], borders[i][2], borders[i][3]);
+	g_free (files[i]);
+      }
+
+  return expected;
+}
+
+static gboolean
+prewarm_scan_gtkrc (const char  *filename,
+                    GPtrArray   *pixmap_path,
+                    GPtrArray   *requests,
+                    int          depth,
+                    GError     **err)
+{
+  GScanner *scanner;
+  char     *contents;
+  gsize     length;
+  char     *dirname;
+  guint     token, expected = G_TOKEN_NONE;
+  guint     i;
+
+  if (!g_file_get_contents (filename, &contents, &length, err))
+    return FALSE;
+
+  dirname = g_path_get_dirname (filename);
+
+  scanner = g_scanner_new (NULL);
+  scanner->config->case_sensitive = TRUE;
+  scanner->config->symbol_2_token = TRUE;
+  scanner->input_name = filename;
+  g_scanner_input_text (scanner, contents, length);
+
+  g_scanner_scope_add_symbol (scanner, 0, "image", GUINT_TO_POINTER (TOKEN_IMAGE));
+  g_scanner_scope_add_symbol (scanner, 0, "include", GUINT_TO_POINTER (TOKEN_INCLUDE));
+  g_scanner_scope_add_symbol (scanner, 0, "pixmap_path", GUINT_TO_POINTER (TOKEN_PIXMAP_PATH));
+  for (i = 0; i < G_N_ELEMENTS (image_keys); i++)
+    {
+      g_scanner_scope_add_symbol (scanner, 0, image_keys[i].file,
+				  GUINT_TO_POINTER (TOKEN_FILE + i));
+      g_scanner_scope_add_symbol (scanner, 0, image_keys[i].border,
+				  GUINT_TO_POINTER (TOKEN_BORDER + i));
+    }
+
+  while (expected == G_TOKEN_NONE &&
+	 (token = g_scanner_get_next_token (scanner)) != G_TOKEN_EOF)
+    {
+      switch (token)
+	{
+	case TOKEN_IMAGE:
+	  expected = prewarm_parse_image (scanner, pixmap_path, dirname, requests);
+	  break;
+
+	case TOKEN_INCLUDE:
+	  if (g_scanner_get_next_token (scanner) != G_TOKEN_STRING)
+	    expected = G_TOKEN_STRING;
+	  else if (depth >= PREWARM_MAX_INCLUDE_DEPTH)
+	    g_scanner_warn (scanner, "includes nested too deeply");
+	  else
+	    {
+	      char   *include;
+	      GError *error = NULL;
+
+	      if (g_path_is_absolute (scanner->value.v_string))
+		include = g_strdup (scanner->value.v_string);
+	      else
+		include = g_build_filename (dirname, scanner->value.v_string, NULL);
+
+	      if (!prewarm_scan_gtkrc (include, pixmap_path, requests, depth + 1, &error))
+		{
+		  g_scanner_warn (scanner, "%s", error->message);
+		  g_error_free (error);
+		}
+	      g_free (include);
+	    }
+	  break;
+
+	case TOKEN_PIXMAP_PATH:
+	  if (g_scanner_get_next_token (scanner) != G_TOKEN_STRING)
+	    expected = G_TOKEN_STRING;
+	  else
+	    {
+	      char **dirs = g_strsplit (scanner->value.v_string, G_SEARCHPATH_SEPARATOR_S, -1);
+
+	      /* like in gtkrc, a new pixmap_path replaces the old one */
+	      g_ptr_array_foreach (pixmap_path, (GFunc) g_free, NULL);
+	      g_ptr_array_set_size (pixmap_path, 0);
+	      for (i = 0; dirs[i]; i++)
+		if (*dirs[i])
+		  g_ptr_array_add (pixmap_path, g_strdup (dirs[i]));
+	      g_strfreev (dirs);
+	    }
+	  break;
+
+	default:
+	  /* everything else is for gtk and the engines */
+	  break;
+	}
+    }
+
+  if (expected != G_TOKEN_NONE)
+    g_scanner_unexp_token (scanner, expected, NULL, NULL, NULL, NULL, FALSE);
+
+  g_scanner_destroy (scanner);
+  g_free (dirname);
+  g_free (contents);
+
+  return TRUE;
+}
+
+/* Finds the images of a theme by scanning the image {} blocks of its gtkrc
+ * and the files it includes, using the same keys as sapwood-rc-style.c.
+ */
+gboolean
+prewarm_parse_gtkrc (const char  *filename,
+                     GPtrArray   *requests,
+                     GError     **err)
+{
+  GPtrArray *pixmap_path;
+  gboolean   retval;
+
+  pixmap_path = g_ptr_array_new ();
+  retval = prewarm_scan_gtkrc (filename, pixmap_path, requests, 0, err);
+  g_ptr_array_foreach (pixmap_path, (GFunc) g_free, NULL);
+  g_ptr_array_free (pixmap_path, TRUE);
+
+  return retval;
+}
@@ -0,0 +1,37 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef PREWARM_H
+#define PREWARM_H
+
+#include "sapwood-proto.h"
+
+G_BEGIN_DECLS
+
+/* Both functions append newly allocated PixbufOpenRequests to @requests,
+ * free them with g_free() */
+gboolean prewarm_parse_manifest (const char  *filename,
+                                 GPtrArray   *requests,
+                                 GError     **err);
+gboolean prewarm_parse_gtkrc    (const char  *filename,
+                                 GPtrArray   *requests,
+                                 GError     **err);
+
+G_END_DECLS
+
+#endif /* !PREWARM_H */
@@ -0,0 +1,321 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* sapwood-pack: decodes the images of a theme into a theme pack for
+ * sapwood-server --pack */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gdk/gdk.h>
+
+#include "image-slice.h"
+#include "pixbuf-decode.h"
+#include "prewarm.h"
+#include "snapshot.h"
+#include "tile-alpha.h"
+
+typedef struct
+{
+  SnapshotImage    image;
+  cairo_surface_t *surface;
+  GArray          *slices;      /* SnapshotSlice */
+} PackImage;
+
+static char **gtkrc_filenames = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "gtkrc", 'r', 0, G_OPTION_ARG_FILENAME_ARRAY, &gtkrc_filenames,
+    "Slice the images with the borders used by the gtkrc FILE (default: the gtkrc of each DIRECTORY)", "FILE" },
+  { NULL }
+};
+
+static void
+pack_image_free (PackImage *pack_image)
+{
+  cairo_surface_destroy (pack_image->surface);
+  g_array_free (pack_image->slices, TRUE);
+  g_free ((gchar *) pack_image->image.filename);
+  g_free ((gchar *) pack_image->image.digest);
+  g_free (pack_image);
+}
+
+/* decodes @filename, keyed by its real path like the engine opens it */
+static void
+pack_add_image (GHashTable *images,
+                const char *filename)
+{
+  char       abspath[PATH_MAX + 1];
+  PackImage *pack_image;
+  GdkPixbuf *pixbuf;
+  GError    *error = NULL;
+  gint64     mtime, file_size;
+
+  if (!realpath (filename, abspath) ||
+      g_hash_table_lookup (images, abspath))
+    return;
+
+  /* only files gdk-pixbuf recognizes, without decoding them twice */
+  if (!gdk_pixbuf_get_file_info (abspath, NULL, NULL))
+    return;
+
+  if (!snapshot_file_stat (abspath, &mtime, &file_size))
+    return;
+
+  pixbuf = gdk_pixbuf_new_from_file (abspath, &error);
+  if (!pixbuf)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  pack_image = g_new0 (PackImage, 1);
+  pack_image->surface = pixbuf_to_surface (pixbuf);
+  pack_image->slices  = g_array_new (FALSE, TRUE, sizeof (SnapshotSlice));
+
+  pack_image->image.filename  = g_strdup (abspath);
+  pack_image->image.mtime     = mtime;
+  pack_image->image.file_size = file_size;
+  pack_image->image.width     = cairo_image_surface_get_width (pack_image->surface);
+  pack_image->image.height    = cairo_image_surface_get_height (pack_image->surface);
+  pack_image->image.stride    = cairo_image_surface_get_stride (pack_image->surface);
+  pack_image->image.has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  pack_image->image.pixels    = cairo_image_surface_get_data (pack_image->surface);
+  pack_image->image.digest    = pixbuf_digest (pixbuf);
+
+  g_object_unref (pixbuf);
+
+  g_hash_table_insert (images, (gpointer) pack_image->image.filename, pack_image);
+}
+
+static void
+pack_add_directory (GHashTable *images,
+                    const char *dirname)
+{
+  GDir       *dir;
+  const char *name;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      char *filename = g_build_filename (dirname, name, NULL);
+
+      if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+        {
+          if (!g_file_test (filename, G_FILE_TEST_IS_SYMLINK))
+            pack_add_directory (images, filename);
+        }
+      else if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+        pack_add_image (images, filename);
+
+      g_free (filename);
+    }
+
+  g_dir_close (dir);
+}
+
+/* classifies the parts of @pack_image sliced as @req asks for, the same
+ * way sapwood-server does */
+static void
+pack_add_slice (PackImage               *pack_image,
+                const PixbufOpenRequest *req)
+{
+  const guchar  *pixels = pack_image->image.pixels;
+  gint           stride = pack_image->image.stride;
+  gint           width  = pack_image->image.width;
+  gint           height = pack_image->image.height;
+  gint           bounds_x[4], bounds_y[4];
+  SnapshotSlice  slice;
+  gint           i, j;
+
+  if (snapshot_image_find_slice (&pack_image->image,
+                                 req->border_left, req->border_right,
+                                 req->border_top, req->border_bottom))
+    return;
+
+  memset (&slice, 0, sizeof (slice));
+  slice.border_left   = req->border_left;
+  slice.border_right  = req->border_right;
+  slice.border_top    = req->border_top;
+  slice.border_bottom = req->border_bottom;
+
+  image_slice_bounds (width, height,
+                      req->border_left, req->border_right,
+                      req->border_top, req->border_bottom,
+                      bounds_x, bounds_y);
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+        gint      x = bounds_x[j], w = bounds_x[j + 1] - x;
+        gint      y = bounds_y[i], h = bounds_y[i + 1] - y;
+        guint     bit = 1 << (i * 3 + j);
+        TileAlpha alpha = TILE_ALPHA_OPAQUE;
+        guint32   color;
+
+        if (w <= 0 || h <= 0)
+          continue;
+
+        if (pack_image->image.has_alpha)
+          alpha = tile_alpha_classify (pixels, stride, x, y, w, h);
+
+        if (alpha == TILE_ALPHA_TRANSPARENT)
+          slice.transparent |= bit;
+        else if (alpha == TILE_ALPHA_MIXED)
+          slice.mixed |= bit;
+        else if (tile_alpha_is_solid (pixels, stride, x, y, w, h, &color))
+          {
+            slice.solid |= bit;
+            slice.color[i][j] = color;
+          }
+      }
+
+  g_array_append_val (pack_image->slices, slice);
+  pack_image->image.slices   = (const SnapshotSlice *) pack_image->slices->data;
+  pack_image->image.n_slices = pack_image->slices->len;
+}
+
+static void
+pack_add_gtkrc (GHashTable *images,
+                const char *filename)
+{
+  GPtrArray *requests = g_ptr_array_new ();
+  GError    *error = NULL;
+  guint      i;
+
+  if (!prewarm_parse_gtkrc (filename, requests, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
+
+  for (i = 0; i < requests->len; i++)
+    {
+      PixbufOpenRequest *req = g_ptr_array_index (requests, i);
+      char               abspath[PATH_MAX + 1];
+      PackImage         *pack_image = NULL;
+
+      if (realpath (req->filename, abspath))
+        pack_image = g_hash_table_lookup (images, abspath);
+
+      if (pack_image)
+        pack_add_slice (pack_image, req);
+      else
+        g_printerr ("%s: not in the pack\n", req->filename);
+
+      g_free (req);
+    }
+
+  g_ptr_array_free (requests, TRUE);
+}
+
+static gint
+compare_images (gconstpointer a,
+                gconstpointer b)
+{
+  const SnapshotImage *ia = a;
+  const SnapshotImage *ib = b;
+
+  return strcmp (ia->filename, ib->filename);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  GHashTable     *images;
+  GHashTableIter  iter;
+  PackImage      *pack_image;
+  GArray         *array;
+  gint            i;
+
+  context = g_option_context_new ("OUTPUT DIRECTORY... - build a sapwood theme pack");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (argc < 3)
+    {
+      g_printerr ("usage: %s [--gtkrc FILE]... OUTPUT DIRECTORY...\n", argv[0]);
+      return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2,36,0)
+  g_type_init ();
+#endif
+
+  images = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                  (GDestroyNotify) pack_image_free);
+
+  for (i = 2; i < argc; i++)
+    pack_add_directory (images, argv[i]);
+
+  if (gtkrc_filenames)
+    for (i = 0; gtkrc_filenames[i]; i++)
+      pack_add_gtkrc (images, gtkrc_filenames[i]);
+  else
+    for (i = 2; i < argc; i++)
+      {
+        char *gtkrc = g_build_filename (argv[i], "gtkrc", NULL);
+
+        if (!g_file_test (gtkrc, G_FILE_TEST_IS_REGULAR))
+          {
+            g_free (gtkrc);
+            gtkrc = g_build_filename (argv[i], "gtk-2.0", "gtkrc", NULL);
+          }
+        if (g_file_test (gtkrc, G_FILE_TEST_IS_REGULAR))
+          pack_add_gtkrc (images, gtkrc);
+        g_free (gtkrc);
+      }
+
+  /* sorted, so that packing the same theme gives the same file */
+  array = g_array_new (FALSE, FALSE, sizeof (SnapshotImage));
+  g_hash_table_iter_init (&iter, images);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pack_image))
+    g_array_append_val (array, pack_image->image);
+  g_array_sort (array, compare_images);
+
+  if (!snapshot_write (argv[1], (const SnapshotImage *) array->data,
+                       array->len, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  g_print ("%s: %u images\n", argv[1], array->len);
+
+  g_array_free (array, TRUE);
+  g_hash_table_destroy (images);
+  g_strfreev (gtkrc_filenames);
+
+  return 0;
+}
@@ -21,15 +21,26 @@
 #include <config.h>
 
 #include "cache-node.h"
+#include "image-slice.h"
+#include "pixbuf-decode.h"
+#include "pixel-convert.h"
+#include "prewarm.h"
+#include "shelf-packer.h"
+#include "snapshot.h"
+#include "tile-alpha.h"
 
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -46,13 +57,241 @@ gboolean enable_debug = FALSE;
 #endif
 
 static GMainLoop *main_loop;
+static int        signal_pipe[2] = { -1, -1 };
 static GCache *pixmap_cache   = NULL;
 static int     pixmap_counter = 0;
 static int     pixbuf_counter = 0;
 static int     server_depth   = 0;
 
+/* the depth of the pixmaps for @req */
+#define REQUEST_DEPTH(req) ((req)->depth ? (req)->depth : server_depth)
+
+/* upload every image as a single pixmap and mask */
+static gboolean atlas_mode    = FALSE;
+#define ATLAS_STRIP_MIN 64
+/* the atlases up to this size share the pages below */
+#define ATLAS_SHARED_MAX 128
+#define ATLAS_PAGE_SIZE  512
+
+/* the stretched parts that are constant along the stretched axis are
+ * uploaded as a strip of this length instead */
+#define STRIP_SIZE 64
+
+/* a pixmap (and mask) holding the atlases of several small images */
+typedef struct
+{
+  gint         depth;
+  ShelfPacker *packer;
+  GdkPixmap   *pixmap;
+  GdkBitmap   *pixmask;         /* created once an image needs it */
+  guint        n_atlases;
+} AtlasPage;
+
+static GSList *atlas_pages = NULL;
+
+/* a part uploaded as a pixmap of its own, shared by all the images that
+ * have a part with the same pixels */
+typedef struct
+{
+  gchar   *key;                 /* in tiles */
+  guint32  pixmap;
+  guint32  pixmask;             /* None if fully opaque */
+  gsize    size;                /* bytes used in the X server */
+  guint    refcnt;              /* parts using it */
+} Tile;
+
+static GHashTable *tiles         = NULL; /* "depth/size/digest" -> Tile */
+static GHashTable *tiles_by_xid  = NULL; /* pixmap XID -> Tile */
+
+/* images from this size on are uploaded with MIT-SHM, if available */
+#define SHM_MIN_PIXELS (128 * 128)
+static gboolean shm_unavailable = FALSE;
+
 static const char *sock_path;
 
+/* at most this much is read from a client in one main loop iteration, so
+ * a busy client cannot hold up the others */
+#define CLIENT_READ_SIZE   16384
+/* a client is not read from while this much output is waiting for it */
+#define CLIENT_OUTPUT_MAX  (256 * 1024)
+
+typedef struct
+{
+  int         fd;
+  guint32     events;           /* registered with epoll */
+  gboolean    dispatching;      /* the events are updated afterwards */
+  GByteArray *inbuf;            /* incomplete requests */
+  GByteArray *outbuf;           /* replies not written yet */
+  gsize       outbuf_ofs;       /* of the first byte not written */
+  GHashTable *cleanup;          /* id -> CacheNode */
+  GSList     *pending;          /* PendingReply */
+  pid_t       pid;              /* 0 if unknown */
+  guint       n_opens;
+} Client;
+
+/* a reply waiting for images to be loaded */
+typedef struct
+{
+  Client             *client;   /* NULL if the client went away */
+  guint32             seq;
+  gboolean            batch;
+  guint               n_pending;
+  guint               n_reps;
+  PixbufOpenResponse  reps[1];  /* n_reps */
+} PendingReply;
+
+typedef struct
+{
+  PendingReply *reply;          /* NULL for prewarming */
+  guint         index;
+} PixbufWaiter;
+
+/* the cache values, handed out as their PixbufOpenResponse */
+typedef struct _PixbufEntry
+{
+  PixbufOpenResponse  rep;      /* must be first */
+  PixbufOpenRequest  *req;      /* the cache key */
+  gboolean            loaded;
+  guint               refcnt;   /* same as the one of the cache */
+  gsize               size;     /* bytes used by the pixmaps in the X server */
+  time_t              released; /* when the last reference was dropped */
+  GList              *link;     /* in retained, while unreferenced */
+  AtlasPage          *page;     /* holding the atlas, or NULL */
+  GdkRectangle        page_rect;
+  gchar              *content_key; /* in content_entries, once loaded */
+  struct _PixbufEntry *same;    /* whose pixmaps are used, referenced */
+} PixbufEntry;
+
+/* a decoded image file, shared by all the border sets it is sliced with */
+typedef struct
+{
+  char               *filename; /* the key in pixbuf_sources */
+  cairo_surface_t    *surface;  /* set by the worker, premultiplied */
+  gchar              *digest;   /* of the pixels, for finding copies */
+  gint64              mtime;    /* of the file when it was decoded */
+  gint64              file_size;
+  gboolean            snapshotted; /* no need to add it to the snapshot */
+  SnapshotImage       snapshot_image; /* if the surface is mapped from one */
+  /* converted for the upload once used */
+  gboolean            converted;
+  GdkImage           *image;    /* NULL to paint surface with cairo */
+  GdkImage           *mask;     /* NULL unless surface has alpha */
+  GError             *error;
+  gdouble             decode_time;
+  gboolean            prewarm;  /* no client is waiting for it yet */
+  /* only used from the main thread */
+  gboolean            decoded;
+  gboolean            busy;     /* in the thread pool or in loads_done */
+  GSList             *loads;    /* PixbufLoad to slice once it is decoded */
+  gsize               size;
+  GList              *link;     /* in decoded, while not busy */
+} PixbufSource;
+
+/* a decoded image for the next snapshot */
+typedef struct
+{
+  gchar              *filename; /* the key in snapshot_pending */
+  gchar              *digest;
+  gint64              mtime;
+  gint64              file_size;
+  cairo_surface_t    *surface;  /* referenced */
+} SnapshotPending;
+
+/* a snapshot written by snapshot_pool */
+typedef struct
+{
+  GArray             *images;   /* SnapshotImage */
+  Snapshot           *last;     /* with the pixels of the images kept,
+				   referenced, or NULL */
+  GHashTable         *pending;  /* with the pixels of the new ones */
+  Snapshot           *written;
+  GError             *error;
+} SnapshotJob;
+
+/* an image being decoded or sliced */
+typedef struct
+{
+  PixbufOpenResponse *rep;
+  PixbufOpenRequest  *req;
+  GError             *error;
+  GSList             *waiters;  /* PixbufWaiter */
+  gboolean            prewarm;  /* no client is waiting for it yet */
+} PixbufLoad;
+
+/* all sockets are watched by a single epoll instance, all the clients
+ * that are ready are served in the same main loop iteration */
+typedef struct
+{
+  GSource             source;
+  GPollFD             pollfd;   /* the epoll fd */
+  int                 listen_fd;
+  struct epoll_event *events;
+  int                 n_events;
+} ClientSource;
+
+static ClientSource *client_source = NULL;
+static guint         n_clients     = 0;
+
+static GThreadPool *load_pool   = NULL;
+static GAsyncQueue *loads_done  = NULL;
+static GHashTable  *pixbuf_loads = NULL; /* PixbufOpenResponse -> PixbufLoad */
+static gboolean     prewarming  = FALSE;
+
+/* decoded images are kept so slicing a file with other borders does not
+ * decode it again */
+static GHashTable  *pixbuf_sources = NULL; /* filename -> PixbufSource */
+
+/* decoded images of sapwood-pack, in the order given */
+static GSList      *packs             = NULL; /* Snapshot */
+
+/* decoded images of earlier runs, and the ones decoded since to be added */
+static gchar       *snapshot_filename = NULL;
+static Snapshot    *snapshot          = NULL;
+static GHashTable  *snapshot_pending  = NULL; /* filename -> SnapshotPending */
+static GHashTable  *snapshot_used     = NULL; /* filenames opened since the
+						  last one was written */
+static guint        snapshot_timeout  = 0;
+static GThreadPool *snapshot_pool     = NULL; /* writes one at a time */
+static GAsyncQueue *snapshots_done    = NULL; /* SnapshotJob */
+static gboolean     snapshot_writing  = FALSE;
+/* seconds without decoding an image before the snapshot is written */
+#define SNAPSHOT_DELAY 10
+#define PIXBUF_SOURCE_HAS_ALPHA(source) \
+  (cairo_image_surface_get_format ((source)->surface) == CAIRO_FORMAT_ARGB32)
+static GQueue       decoded        = G_QUEUE_INIT; /* PixbufSource, oldest first */
+static gsize        decoded_size   = 0;
+static gint         decoded_bytes  = 4 * 1024 * 1024;
+
+/* unreferenced images are kept for a while before they are destroyed */
+static gint         retain_seconds = 60;
+static gint         retain_bytes   = 4 * 1024 * 1024;
+static GQueue       retained       = G_QUEUE_INIT; /* PixbufEntry, oldest first */
+static GHashTable  *retained_hash  = NULL;         /* PixbufOpenRequest -> PixbufEntry */
+static gsize        retained_size  = 0;
+static guint        retained_timeout = 0;
+
+/* the X server memory used by all images, retained ones included */
+static GHashTable  *pixbuf_entries = NULL; /* PixbufEntry set */
+/* "digest/borders/depth" -> PixbufEntry with pixmaps of its own, so that
+ * the same image under another name shares them */
+static GHashTable  *content_entries = NULL;
+static gsize        pixmap_bytes   = 0;
+static gint         max_bytes      = 0;    /* 0 for no limit */
+
+/* for PIXBUF_OP_STATS */
+static GSList      *clients        = NULL;
+static guint        stats_hits     = 0;
+static guint        stats_misses   = 0;
+static guint        stats_revived  = 0;
+static gdouble      stats_decode_time = 0;
+static gdouble      stats_upload_time = 0;
+
+static gboolean            pixbuf_load_done        (gpointer                 user_data);
+static gboolean            pixbuf_report_usage     (gpointer                 user_data);
+static PixbufOpenRequest * pixbuf_open_request_dup (const PixbufOpenRequest *req);
+static void                pixbuf_open_request_destroy (PixbufOpenRequest *req);
+static void                pixbuf_cache_remove     (PixbufOpenResponse      *rep);
+
 #ifndef HAVE_ABSTRACT_SOCKETS
 static void
 atexit_handler (void)
@@ -61,33 +300,81 @@ atexit_handler (void)
 }
 #endif
 
+/* the handler only writes the signal number to signal_pipe, it is acted
+ * upon from the main loop */
 static void
 signal_handler (int signum)
 {
-  switch (signum)
-    {
-    case SIGHUP:
-      break;
-    case SIGINT:
-    case SIGTERM:
-      g_main_loop_quit (main_loop);
-      break;
-    }
+  int    saved_errno = errno;
+  guint8 byte = signum;
+
+  if (write (signal_pipe[1], &byte, 1) < 0)
+    ; /* full, a signal is pending already */
+
+  errno = saved_errno;
 }
 
-static void
-extract_pixmap_single (GdkPixbuf  *pixbuf,
-		       int i, int j,
-		       int x, int y,
-		       int width, int height,
-		       PixbufOpenResponse *rep)
+static gboolean
+signal_pipe_callback (GIOChannel   *source,
+                      GIOCondition  condition,
+                      gpointer      user_data)
 {
-  static GdkWindow* rgba_window = NULL;
-  GdkPixmap    *pixmap;
-  gboolean      need_mask;
-  cairo_t      *cr;
+  guint8 byte;
 
-  if (G_UNLIKELY (!rgba_window)) {
+  while (read (signal_pipe[0], &byte, 1) == 1)
+    switch (byte)
+      {
+      case SIGUSR1:
+        pixbuf_report_usage (NULL);
+        break;
+      case SIGINT:
+      case SIGTERM:
+        g_main_loop_quit (main_loop);
+        break;
+      }
+
+  return TRUE;
+}
+
+/* the pixel value of the premultiplied 0xRRGGBB @color in the pixmaps,
+ * only for true color visuals; the bits not used by the colors are set, so
+ * that the pixels are opaque on ARGB visuals */
+static gboolean
+pixel_for_color (GdkVisual *visual,
+		 guint32    color,
+		 guint32   *pixel)
+{
+  guint32 r = (color >> 16) & 0xff;
+  guint32 g = (color >> 8) & 0xff;
+  guint32 b = color & 0xff;
+
+  if (visual->type != GDK_VISUAL_TRUE_COLOR &&
+      visual->type != GDK_VISUAL_DIRECT_COLOR)
+    return FALSE;
+
+  /* truncated like cairo does when painting the pixmaps */
+  *pixel = (r >> (8 - visual->red_prec)) << visual->red_shift |
+	   (g >> (8 - visual->green_prec)) << visual->green_shift |
+	   (b >> (8 - visual->blue_prec)) << visual->blue_shift |
+	   (~(visual->red_mask | visual->green_mask | visual->blue_mask) &
+	    (visual->depth < 32 ? (1u << visual->depth) - 1 : 0xffffffff));
+
+  return TRUE;
+}
+
+/* The pixmaps are created for a window of the depth they are requested in,
+ * with the system visual for the depth of the screen and a true color one
+ * for the others. Returns NULL if there is no such visual.
+ */
+static GdkWindow *
+get_depth_window (gint depth)
+{
+  static GdkWindow* windows[33] = { NULL, };
+
+  if (depth < 1 || depth > 32)
+    return NULL;
+
+  if (G_UNLIKELY (!windows[depth])) {
         GdkWindowAttr attrs = {
                 NULL,                        /* gchar *title */
                 0,                           /* gint event_mask */
@@ -105,35 +392,395 @@ extract_pixmap_single (GdkPixbuf  *pixbuf,
                 GDK_WINDOW_TYPE_HINT_NORMAL, /* GdkWindowTypeHint type_hint */
         };
         GdkScreen* screen = gdk_screen_get_default ();
-        attrs.visual = gdk_screen_get_rgb_visual (screen);
-        attrs.colormap = gdk_screen_get_rgb_colormap (screen);
-        rgba_window = gdk_window_new (gdk_screen_get_root_window (screen), &attrs,
-                                 GDK_WA_VISUAL | GDK_WA_COLORMAP);
+
+        if (depth == server_depth) {
+                attrs.visual = gdk_screen_get_system_visual (screen);
+                attrs.colormap = g_object_ref (gdk_screen_get_system_colormap (screen));
+        } else {
+                attrs.visual = gdk_visual_get_best_with_both (depth, GDK_VISUAL_TRUE_COLOR);
+                if (!attrs.visual)
+                        return NULL;
+                attrs.colormap = gdk_colormap_new (attrs.visual, FALSE);
+        }
+
+        windows[depth] = gdk_window_new (gdk_screen_get_root_window (screen), &attrs,
+                                         GDK_WA_VISUAL | GDK_WA_COLORMAP);
+        g_object_unref (attrs.colormap);
   }
 
-  pixmap = gdk_pixmap_new (rgba_window, width, height, -1);
+  return windows[depth];
+}
+
+/* the converted image of @source if it can be uploaded to @pixmap, NULL if
+ * it has to be painted with cairo */
+static GdkImage *
+pixbuf_source_get_image (PixbufSource *source,
+			 GdkDrawable  *pixmap)
+{
+  if (source->image && source->image->depth == gdk_drawable_get_depth (pixmap))
+    return source->image;
+
+  return NULL;
+}
+
+/* Sets the geometry of part [i][j] and checks whether it needs a pixmap at
+ * all: fully transparent parts are not drawn and solid ones are sent as a
+ * color. Otherwise @need_mask tells whether the part needs a mask.
+ */
+static gboolean
+classify_part (PixbufSource *source,
+	       const SnapshotSlice *slice,
+	       int i, int j,
+	       int x, int y,
+	       int width, int height,
+	       gboolean *need_mask,
+	       PixbufOpenResponse *rep)
+{
+  cairo_surface_t *surface = source->surface;
+  TileAlpha        alpha = TILE_ALPHA_OPAQUE;
+  guint32          color;
+  gboolean         solid;
+  guint            bit = 1 << (i * 3 + j);
+
+  rep->tile_width[i][j]  = width;
+  rep->tile_height[i][j] = height;
+
+  /* a theme pack has them already */
+  if (slice)
+    {
+      if (slice->transparent & bit)
+	alpha = TILE_ALPHA_TRANSPARENT;
+      else if (slice->mixed & bit)
+	alpha = TILE_ALPHA_MIXED;
+    }
+  else if (PIXBUF_SOURCE_HAS_ALPHA (source))
+    alpha = tile_alpha_classify (cairo_image_surface_get_data (surface),
+				 cairo_image_surface_get_stride (surface),
+				 x, y, width, height);
+
+  /* opaque parts do not need a mask at all */
+  *need_mask = alpha == TILE_ALPHA_MIXED;
+
+  /* nothing would be drawn anyway */
+  if (alpha == TILE_ALPHA_TRANSPARENT)
+    return FALSE;
+
+  if (alpha != TILE_ALPHA_OPAQUE)
+    return TRUE;
+
+  if (slice)
+    {
+      solid = (slice->solid & bit) != 0;
+      color = slice->color[i][j];
+    }
+  else
+    solid = tile_alpha_is_solid (cairo_image_surface_get_data (surface),
+				 cairo_image_surface_get_stride (surface),
+				 x, y, width, height, &color);
+
+  /* the client fills it with a solid color instead */
+  if (solid &&
+      pixel_for_color (gdk_drawable_get_visual (get_depth_window (rep->depth)),
+		       color, &rep->color[i][j]))
+    {
+      rep->solid |= bit;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Converts the decoded image to the pixel format of the screen (dithered
+ * for 16 bit visuals) and to a bitmap of its alpha threshold in a single
+ * pass, all the parts in the depth of the screen are then uploaded from
+ * there; the ones requested in other depths are painted with cairo. Large
+ * images go into a shared memory segment, so that XShmPutImage can upload
+ * them without sending the pixels over the X connection; if the X server
+ * does not support MIT-SHM (e.g. on remote displays) they are sent with
+ * XPutImage like the small ones. The pixels are painted with cairo for
+ * visuals they can not be computed for.
+ */
+static void
+pixbuf_source_convert (PixbufSource *source)
+{
+  GdkVisual *visual = gdk_screen_get_system_visual (gdk_screen_get_default ());
+  guchar    *data   = cairo_image_surface_get_data (source->surface);
+  gint       stride = cairo_image_surface_get_stride (source->surface);
+  gint       width  = cairo_image_surface_get_width (source->surface);
+  gint       height = cairo_image_surface_get_height (source->surface);
+  gboolean   direct = FALSE;
+  gboolean   direct_565 = FALSE;
+  gint       x, y;
+
+  if (source->converted)
+    return;
+  source->converted = TRUE;
+
+  if (visual->type == GDK_VISUAL_TRUE_COLOR ||
+      visual->type == GDK_VISUAL_DIRECT_COLOR)
+    {
+      if (width * height >= SHM_MIN_PIXELS && !shm_unavailable)
+	{
+	  source->image = gdk_image_new (GDK_IMAGE_SHARED, visual, width, height);
+	  if (!source->image)
+	    {
+	      LOG ("MIT-SHM is not available, uploading through the X connection");
+	      shm_unavailable = TRUE;
+	    }
+	}
+      if (!source->image)
+	source->image = gdk_image_new (GDK_IMAGE_NORMAL, visual, width, height);
+    }
+
+  if (source->image &&
+      source->image->byte_order == (G_BYTE_ORDER == G_LITTLE_ENDIAN ? GDK_LSB_FIRST : GDK_MSB_FIRST))
+    {
+      direct = source->image->bpp == 4 && visual->depth == 24 &&
+	       visual->red_shift == 16 && visual->red_prec == 8 &&
+	       visual->green_shift == 8 && visual->green_prec == 8 &&
+	       visual->blue_shift == 0 && visual->blue_prec == 8;
+      direct_565 = source->image->bpp == 2 &&
+		   visual->red_shift == 11 && visual->red_prec == 5 &&
+		   visual->green_shift == 5 && visual->green_prec == 6 &&
+		   visual->blue_shift == 0 && visual->blue_prec == 5;
+    }
+
+  /* owned by the image, which frees it with free() */
+  if (PIXBUF_SOURCE_HAS_ALPHA (source))
+    source->mask = gdk_image_new_bitmap (gdk_visual_get_system (),
+					 malloc ((width + 7) / 8 * height),
+					 width, height);
+
+  for (y = 0; y < height; y++)
+    {
+      const guint32 *src = (const guint32 *) (data + y * stride);
+      gpointer       dst = NULL;
+      guint8        *mask = NULL;
+
+      if (direct || direct_565)
+	dst = (guchar *) source->image->mem + y * source->image->bpl;
+      if (source->mask)
+	mask = (guint8 *) source->mask->mem + y * source->mask->bpl;
+
+      if (direct_565)
+	pixel_convert_row_565 (src, dst, mask, width, y);
+      else
+	pixel_convert_row (src, dst, mask, width);
+
+      if (source->image && !direct && !direct_565)
+	for (x = 0; x < width; x++)
+	  {
+	    guint32 pixel;
+
+	    if (pixel_for_color (visual, src[x] & 0xffffff, &pixel))
+	      gdk_image_put_pixel (source->image, x, y, pixel);
+	  }
+    }
+}
+
+/* copies the width x height pixels at (x, y) of the image to (dest_x,
+ * dest_y) of @pixmap, which has to be black there if there is no converted
+ * image */
+static void
+upload_pixels (GdkPixmap       *pixmap,
+	       cairo_t         *cr,
+	       PixbufSource    *source,
+	       int x, int y,
+	       int dest_x, int dest_y,
+	       int width, int height)
+{
+  static GdkGC *gc = NULL;
+  GdkImage     *image = pixbuf_source_get_image (source, pixmap);
+
+  if (!image)
+    {
+      cairo_set_source_surface (cr, source->surface, dest_x - x, dest_y - y);
+      cairo_rectangle (cr, dest_x, dest_y, width, height);
+      cairo_fill (cr);
+      return;
+    }
+
+  /* only pixmaps in the depth of the screen get here */
+  if (G_UNLIKELY (!gc))
+    gc = gdk_gc_new (pixmap);
+
+  gdk_draw_image (pixmap, gc, image, x, y, dest_x, dest_y, width, height);
+}
+
+/* likewise for the alpha threshold, into @pixmask */
+static void
+upload_mask (GdkBitmap    *pixmask,
+	     PixbufSource *source,
+	     int x, int y,
+	     int dest_x, int dest_y,
+	     int width, int height)
+{
+  static GdkGC *gc = NULL;
+
+  if (G_UNLIKELY (!gc))
+    {
+      GdkColor fg = { 1, 0, 0, 0 };
+      GdkColor bg = { 0, 0, 0, 0 };
+
+      /* bitmap images are drawn with the foreground for the ones */
+      gc = gdk_gc_new (pixmask);
+      gdk_gc_set_foreground (gc, &fg);
+      gdk_gc_set_background (gc, &bg);
+    }
+
+  gdk_draw_image (pixmask, gc, source->mask, x, y, dest_x, dest_y, width, height);
+}
+
+/* the key in the tiles of the width x height part at (x, y), repeated to
+ * tile_width x tile_height */
+static gchar *
+tile_key (PixbufSource *source,
+	  int x, int y,
+	  int width, int height,
+	  int tile_width, int tile_height,
+	  int depth)
+{
+  guchar    *data   = cairo_image_surface_get_data (source->surface);
+  gint       stride = cairo_image_surface_get_stride (source->surface);
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  gchar     *key;
+  gint       row;
+
+  for (row = y; row < y + height; row++)
+    g_checksum_update (checksum, data + row * stride + x * 4, width * 4);
+
+  key = g_strdup_printf ("%d/%dx%d/%dx%d/%s", depth, width, height,
+			 tile_width, tile_height,
+			 g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
 
-  cr = gdk_cairo_create (pixmap);
+  return key;
+}
+
+/* drops the reference of a part to the tile with @xid, and frees the tile
+ * with the last one */
+static void
+tile_release (guint32 xid)
+{
+  Tile *tile = g_hash_table_lookup (tiles_by_xid, GUINT_TO_POINTER (xid));
+
+  if (--tile->refcnt)
+    return;
+
+  g_hash_table_remove (tiles_by_xid, GUINT_TO_POINTER (xid));
+  g_hash_table_remove (tiles, tile->key);
+
+  g_object_unref (gdk_xid_table_lookup (tile->pixmap));
+  pixmap_counter--;
+  if (tile->pixmask)
+    {
+      g_object_unref (gdk_xid_table_lookup (tile->pixmask));
+      pixmap_counter--;
+    }
+  pixmap_bytes -= tile->size;
+
+  g_free (tile->key);
+  g_free (tile);
+}
+
+/* repeats the width x height pixels at the origin of @drawable over
+ * tile_width x tile_height, doubling the copied area each time */
+static void
+expand_strip (GdkDrawable *drawable,
+	      int width, int height,
+	      int tile_width, int tile_height)
+{
+  GdkGC *gc = gdk_gc_new (drawable);
+
+  for (; width < tile_width; width *= 2)
+    gdk_draw_drawable (drawable, gc, drawable, 0, 0, width, 0,
+		       MIN (width, tile_width - width), height);
+
+  for (; height < tile_height; height *= 2)
+    gdk_draw_drawable (drawable, gc, drawable, 0, 0, 0, height,
+		       tile_width, MIN (height, tile_height - height));
+
+  g_object_unref (gc);
+}
+
+/* Uploads a part as a pixmap of its own, unless some image has a part with
+ * the same pixels already; many images of a theme only differ in the
+ * middle. The tiles account for their memory themselves.
+ *
+ * A stretched part that is the same all along the stretched axis, like the
+ * middle of a gradient, is reduced to a single pixel there and repeated to
+ * STRIP_SIZE, which is both smaller and cheaper to tile than the whole part
+ * (or a single pixel).
+ */
+static void
+extract_pixmap_single (PixbufSource *source,
+		       int i, int j,
+		       int x, int y,
+		       int width, int height,
+		       gboolean need_mask,
+		       PixbufOpenResponse *rep)
+{
+  guchar       *data   = cairo_image_surface_get_data (source->surface);
+  gint          stride = cairo_image_surface_get_stride (source->surface);
+  GdkPixmap    *pixmap;
+  cairo_t      *cr = NULL;
+  gchar        *key;
+  Tile         *tile;
+  gint          src_width = width, src_height = height;
+  gsize         pixels;
+
+  if (j == 1 && tile_alpha_columns_equal (data, stride, x, y, width, height))
+    src_width = 1;
+  if (i == 1 && tile_alpha_rows_equal (data, stride, x, y, width, height))
+    src_height = 1;
+
+  if (src_width == 1 && j == 1)
+    width = STRIP_SIZE;
+  if (src_height == 1 && i == 1)
+    height = STRIP_SIZE;
+
+  key = tile_key (source, x, y, src_width, src_height, width, height,
+		  rep->depth);
+
+  rep->tile_width[i][j]  = width;
+  rep->tile_height[i][j] = height;
+  pixels = width * height;
+
+  tile = g_hash_table_lookup (tiles, key);
+  if (tile)
+    {
+      g_free (key);
+      tile->refcnt++;
+
+      rep->pixmap[i][j]  = tile->pixmap;
+      rep->pixmask[i][j] = tile->pixmask;
+      return;
+    }
 
-  cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
-  cairo_paint (cr);
+  pixmap = gdk_pixmap_new (get_depth_window (rep->depth), width, height, -1);
 
-  gdk_cairo_set_source_pixbuf (cr, pixbuf, -x, -y);
-  cairo_paint (cr);
-  cairo_destroy (cr);
+  if (!pixbuf_source_get_image (source, pixmap))
+    {
+      cr = gdk_cairo_create (pixmap);
+
+      cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+      cairo_paint (cr);
+    }
+
+  upload_pixels (pixmap, cr, source, x, y, 0, 0, src_width, src_height);
 
-  need_mask = gdk_pixbuf_get_has_alpha (pixbuf);
-  /* FIXME: if the mask would still be all ones, skip creating it altogether */
+  if (cr)
+    cairo_destroy (cr);
+
+  expand_strip (pixmap, src_width, src_height, width, height);
 
   if (need_mask)
     {
       GdkBitmap *pixmask;
 
       pixmask = gdk_pixmap_new (NULL, width, height, 1);
-      gdk_pixbuf_render_threshold_alpha (pixbuf, pixmask,
-					 x, y, 0, 0,
-					 width, height,
-					 128);
+      upload_mask (pixmask, source, x, y, 0, 0, src_width, src_height);
+      expand_strip (pixmask, src_width, src_height, width, height);
 
       rep->pixmask[i][j] = GDK_PIXMAP_XID (pixmask);
       pixmap_counter++;
@@ -141,14 +788,248 @@ extract_pixmap_single (GdkPixbuf  *pixbuf,
 
   rep->pixmap[i][j] = GDK_PIXMAP_XID (pixmap);
   pixmap_counter++;
+
+  tile = g_new0 (Tile, 1);
+  tile->key     = key;
+  tile->pixmap  = rep->pixmap[i][j];
+  tile->pixmask = rep->pixmask[i][j];
+  tile->size    = pixels * (rep->depth > 16 ? 4 : rep->depth > 8 ? 2 : 1) +
+		  (need_mask ? (pixels + 7) / 8 : 0);
+  tile->refcnt  = 1;
+  g_hash_table_insert (tiles, tile->key, tile);
+  g_hash_table_insert (tiles_by_xid, GUINT_TO_POINTER (tile->pixmap), tile);
+
+  pixmap_bytes += tile->size;
+}
+
+/* finds room for a width x height atlas in one of the pages of @depth,
+ * adding a new page if none has it */
+static AtlasPage *
+atlas_page_alloc (gint          depth,
+		  gint          width,
+		  gint          height,
+		  GdkRectangle *rect)
+{
+  AtlasPage *page;
+  GSList    *l;
+
+  rect->width  = width;
+  rect->height = height;
+
+  for (l = atlas_pages; l; l = l->next)
+    {
+      page = l->data;
+
+      if (page->depth == depth &&
+	  shelf_packer_alloc (page->packer, width, height, &rect->x, &rect->y))
+	break;
+    }
+
+  if (!l)
+    {
+      page = g_new0 (AtlasPage, 1);
+      page->depth  = depth;
+      page->packer = shelf_packer_new (ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+      page->pixmap = gdk_pixmap_new (get_depth_window (depth),
+				     ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, -1);
+      pixmap_counter++;
+      atlas_pages = g_slist_prepend (atlas_pages, page);
+
+      /* the atlases are at most ATLAS_SHARED_MAX, always room in a new page */
+      if (!shelf_packer_alloc (page->packer, width, height, &rect->x, &rect->y))
+	g_assert_not_reached ();
+    }
+
+  page->n_atlases++;
+
+  return page;
+}
+
+static void
+atlas_page_release (AtlasPage          *page,
+		    const GdkRectangle *rect)
+{
+  shelf_packer_release (page->packer, rect->x, rect->y, rect->width);
+
+  if (--page->n_atlases)
+    return;
+
+  atlas_pages = g_slist_remove (atlas_pages, page);
+
+  g_object_unref (page->pixmap);
+  pixmap_counter--;
+  if (page->pixmask)
+    {
+      g_object_unref (page->pixmask);
+      pixmap_counter--;
+    }
+  shelf_packer_free (page->packer);
+  g_free (page);
+}
+
+/* Uploads all the parts of an image that need a pixmap as a single pixmap
+ * (and a single mask), a row of the atlas for each row of the parts. The
+ * parts the client tiles are repeated to at least ATLAS_STRIP_MIN pixels,
+ * as the client has to copy them one block at a time. Small atlases are
+ * placed in a shared AtlasPage instead of pixmaps of their own.
+ */
+static void
+extract_atlas (PixbufSource       *source,
+	       GdkRectangle        part[3][3],
+	       gboolean            need_pixmap[3][3],
+	       gboolean            need_mask[3][3],
+	       PixbufOpenResponse *rep)
+{
+  PixbufEntry  *entry = (PixbufEntry *) rep;
+  GdkRectangle  block[3][3];
+  GdkRectangle  area;
+  GdkPixmap    *pixmap;
+  GdkBitmap    *pixmask = NULL;
+  gboolean      any_mask = FALSE;
+  gint          atlas_width = 0;
+  gint          atlas_height = 0;
+  cairo_t      *cr = NULL;
+  int           i, j, x, y;
+
+  for (i = 0; i < 3; i++)
+    {
+      gint row_width = 0;
+      gint row_height = 0;
+
+      for (j = 0; j < 3; j++)
+	{
+	  gint width  = part[i][j].width;
+	  gint height = part[i][j].height;
+
+	  if (!need_pixmap[i][j])
+	    continue;
+
+	  if (j == 1 && width < ATLAS_STRIP_MIN)
+	    width *= (ATLAS_STRIP_MIN + width - 1) / width;
+	  if (i == 1 && height < ATLAS_STRIP_MIN)
+	    height *= (ATLAS_STRIP_MIN + height - 1) / height;
+
+	  block[i][j].x      = row_width;
+	  block[i][j].y      = atlas_height;
+	  block[i][j].width  = width;
+	  block[i][j].height = height;
+
+	  row_width += width;
+	  row_height = MAX (row_height, height);
+	  any_mask |= need_mask[i][j];
+	}
+
+      atlas_width = MAX (atlas_width, row_width);
+      atlas_height += row_height;
+    }
+
+  /* all parts are transparent or solid */
+  if (!atlas_width)
+    return;
+
+  if (atlas_width <= ATLAS_SHARED_MAX && atlas_height <= ATLAS_SHARED_MAX)
+    {
+      AtlasPage *page = atlas_page_alloc (rep->depth, atlas_width, atlas_height, &area);
+
+      if (any_mask && !page->pixmask)
+	{
+	  page->pixmask = gdk_pixmap_new (NULL, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1);
+	  pixmap_counter++;
+	}
+
+      pixmap  = page->pixmap;
+      pixmask = page->pixmask;
+
+      entry->page      = page;
+      entry->page_rect = area;
+
+      atlas_width  = ATLAS_PAGE_SIZE;
+      atlas_height = ATLAS_PAGE_SIZE;
+    }
+  else
+    {
+      area.x      = 0;
+      area.y      = 0;
+      area.width  = atlas_width;
+      area.height = atlas_height;
+
+      pixmap = gdk_pixmap_new (get_depth_window (rep->depth), atlas_width, atlas_height, -1);
+      pixmap_counter++;
+      if (any_mask)
+	{
+	  pixmask = gdk_pixmap_new (NULL, atlas_width, atlas_height, 1);
+	  pixmap_counter++;
+	}
+    }
+
+  if (!pixbuf_source_get_image (source, pixmap))
+    {
+      cr = gdk_cairo_create (pixmap);
+
+      cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+      gdk_cairo_rectangle (cr, &area);
+      cairo_fill (cr);
+    }
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+	GdkRectangle *p = &part[i][j];
+	GdkRectangle *b = &block[i][j];
+
+	if (!need_pixmap[i][j])
+	  continue;
+
+	b->x += area.x;
+	b->y += area.y;
+
+	for (y = 0; y < b->height; y += p->height)
+	  for (x = 0; x < b->width; x += p->width)
+	    {
+	      upload_pixels (pixmap, cr, source,
+			     p->x, p->y, b->x + x, b->y + y,
+			     p->width, p->height);
+
+	      if (need_mask[i][j])
+		upload_mask (pixmask, source,
+			     p->x, p->y, b->x + x, b->y + y,
+			     p->width, p->height);
+	    }
+
+	rep->pixmap[i][j]      = GDK_PIXMAP_XID (pixmap);
+	rep->pixmask[i][j]     = need_mask[i][j] ? GDK_PIXMAP_XID (pixmask) : None;
+	rep->tile_x[i][j]      = b->x;
+	rep->tile_y[i][j]      = b->y;
+	rep->tile_width[i][j]  = b->width;
+	rep->tile_height[i][j] = b->height;
+      }
+
+  if (cr)
+    cairo_destroy (cr);
+
+  rep->atlas_width  = atlas_width;
+  rep->atlas_height = atlas_height;
 }
 
 static gboolean
-extract_pixmaps (GdkPixbuf *pixbuf, const PixbufOpenRequest *req, PixbufOpenResponse *rep, GError **err)
+extract_pixmaps (PixbufSource *source, const PixbufOpenRequest *req, PixbufOpenResponse *rep, GError **err)
 {
+  GdkRectangle part[3][3];
+  gint bounds_x[4], bounds_y[4];
+  gboolean need_pixmap[3][3] = { { FALSE, }, };
+  gboolean need_mask[3][3] = { { FALSE, }, };
   int i, j;
-  gint width  = gdk_pixbuf_get_width (pixbuf);
-  gint height = gdk_pixbuf_get_height (pixbuf);
+  gint width  = cairo_image_surface_get_width (source->surface);
+  gint height = cairo_image_surface_get_height (source->surface);
+  const SnapshotSlice *slice = NULL;
+
+  rep->depth = REQUEST_DEPTH (req);
+  if (!get_depth_window (rep->depth))
+    {
+      g_set_error (err, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+		   "no true color visual of depth %d", rep->depth);
+      return FALSE;
+    }
 
   if (req->border_left + req->border_right > width ||
       req->border_top + req->border_bottom > height)
@@ -183,235 +1064,1273 @@ extract_pixmaps (GdkPixbuf *pixbuf, const PixbufOpenRequest *req, PixbufOpenResp
       g_free(basename);
     }
 
+  slice = snapshot_image_find_slice (&source->snapshot_image,
+				     req->border_left, req->border_right,
+				     req->border_top, req->border_bottom);
+
+  /* borders that do not fit are clamped to the image */
+  image_slice_bounds (width, height,
+		      req->border_left, req->border_right,
+		      req->border_top, req->border_bottom,
+		      bounds_x, bounds_y);
+
   for (i = 0; i < 3; i++)
     {
-      gint y0, y1;
+      gint y0 = bounds_y[i], y1 = bounds_y[i + 1];
 
-      switch (i)
+      for (j = 0; j < 3; j++)
 	{
-	case 0:
-	  y0 = 0;
-	  y1 = req->border_top;
-	  break;
-	case 1:
-	  y0 = req->border_top;
-	  y1 = height - req->border_bottom;
-	  break;
-	default:
-	  y0 = height - req->border_bottom;
-	  y1 = height;
-	  break;
-	}
+	  gint x0 = bounds_x[j], x1 = bounds_x[j + 1];
 
+	  if (x1-x0 > 0 && y1-y0 > 0)
+	    {
+	      part[i][j].x      = x0;
+	      part[i][j].y      = y0;
+	      part[i][j].width  = x1-x0;
+	      part[i][j].height = y1-y0;
+
+	      need_pixmap[i][j] = classify_part (source, slice,
+						 i, j,
+						 x0, y0,
+						 x1-x0, y1-y0,
+						 &need_mask[i][j],
+						 rep);
+
+	      if (need_pixmap[i][j] && !atlas_mode)
+		extract_pixmap_single (source,
+				       i, j,
+				       x0, y0,
+				       x1-x0, y1-y0,
+				       need_mask[i][j],
+				       rep);
+	    }
+	}
+    }
+
+  if (atlas_mode)
+    extract_atlas (source, part, need_pixmap, need_mask, rep);
+
+  rep->width  = width;
+  rep->height = height;
+
+#ifdef DEBUG
+  for (i = 0; i < 3; i++)
+    {
+      char buf[4] = { '\0', };
       for (j = 0; j < 3; j++)
+	buf[j] = rep->pixmap[i][j] ? 'X' : '.';
+      LOG ("  %s", buf);
+    }
+
+  LOG ("pixmaps: %d (%d)", pixmap_counter, pixbuf_counter);
+#endif
+
+  return TRUE;
+}
+
+/* images requested by clients are decoded before the prewarmed ones */
+static gint
+pixbuf_load_compare (gconstpointer a,
+		     gconstpointer b,
+		     gpointer      user_data)
+{
+  const PixbufSource *sa = a;
+  const PixbufSource *sb = b;
+
+  return sa->prewarm - sb->prewarm;
+}
+
+static void
+pixbuf_load_thread (gpointer data,
+		    gpointer user_data)
+{
+  PixbufSource *source = data;
+  GTimer       *timer = g_timer_new ();
+  GdkPixbuf    *pixbuf;
+
+  /* before reading the file, so that the snapshot does not miss a change
+   * made in the meantime; nor does it get files that can not be stat()ed */
+  source->snapshotted = !snapshot_file_stat (source->filename, &source->mtime,
+					     &source->file_size);
+
+  pixbuf = gdk_pixbuf_new_from_file (source->filename, &source->error);
+  if (pixbuf)
+    {
+      source->surface = pixbuf_to_surface (pixbuf);
+      source->digest  = pixbuf_digest (pixbuf);
+      g_object_unref (pixbuf);
+    }
+
+  source->decode_time = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  g_async_queue_push (loads_done, source);
+  g_idle_add (pixbuf_load_done, NULL);
+}
+
+static void
+pixbuf_source_free (PixbufSource *source)
+{
+  g_hash_table_remove (pixbuf_sources, source->filename);
+
+  if (source->surface)
+    cairo_surface_destroy (source->surface);
+  if (source->image)
+    g_object_unref (source->image);
+  if (source->mask)
+    g_object_unref (source->mask);
+  if (source->error)
+    g_error_free (source->error);
+  g_free (source->digest);
+  g_free (source->filename);
+  g_free (source);
+}
+
+/* keeps a decoded image nobody is waiting for, evicting the oldest ones to
+ * stay within --decoded-size */
+static void
+pixbuf_source_release (PixbufSource *source)
+{
+  source->busy = FALSE;
+
+  if (source->decoded)
+    source->size = cairo_image_surface_get_stride (source->surface) * cairo_image_surface_get_height (source->surface) +
+		   (source->image ? source->image->bpl * source->image->height : 0) +
+		   (source->mask ? source->mask->bpl * source->mask->height : 0);
+
+  if (!source->decoded || decoded_bytes <= 0 ||
+      source->size > (gsize) decoded_bytes)
+    {
+      pixbuf_source_free (source);
+      return;
+    }
+
+  g_queue_push_tail (&decoded, source);
+  source->link = decoded.tail;
+  decoded_size += source->size;
+
+  while (decoded_size > (gsize) decoded_bytes)
+    {
+      PixbufSource *oldest = g_queue_pop_head (&decoded);
+
+      decoded_size -= oldest->size;
+      pixbuf_source_free (oldest);
+    }
+}
+
+/* uses the decoded image of a theme pack or of the snapshot for @source,
+ * if the file has not been changed since; its pixels are used right from
+ * the mapping */
+static gboolean
+pixbuf_source_from_snapshot (PixbufSource *source)
+{
+  static cairo_user_data_key_t snapshot_key;
+  SnapshotImage                image;
+  Snapshot                    *found = NULL;
+  GSList                      *l;
+
+  for (l = packs; l && !found; l = l->next)
+    if (snapshot_lookup (l->data, source->filename, &image))
+      found = l->data;
+
+  if (!found && snapshot && snapshot_lookup (snapshot, source->filename, &image))
+    found = snapshot;
+
+  if (!found)
+    return FALSE;
+
+  source->surface = cairo_image_surface_create_for_data ((guchar *) image.pixels,
+							 image.has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+							 image.width, image.height,
+							 image.stride);
+  cairo_surface_set_user_data (source->surface, &snapshot_key,
+			       snapshot_ref (found),
+			       (cairo_destroy_func_t) snapshot_unref);
+
+  source->digest         = g_strdup (image.digest);
+  source->mtime          = image.mtime;
+  source->file_size      = image.file_size;
+  source->snapshotted    = TRUE;
+  source->snapshot_image = image;
+
+  return TRUE;
+}
+
+static void
+snapshot_pending_free (SnapshotPending *pending)
+{
+  cairo_surface_destroy (pending->surface);
+  g_free (pending->filename);
+  g_free (pending->digest);
+  g_free (pending);
+}
+
+static void
+snapshot_mark_used (const gchar *filename)
+{
+  if (!g_hash_table_lookup (snapshot_used, filename))
+    g_hash_table_insert (snapshot_used, g_strdup (filename), GINT_TO_POINTER (TRUE));
+}
+
+/* Collects the images for a new snapshot: the ones decoded since the last
+ * one, and the ones of the last one that are still up to date and were used
+ * since, i.e. opened or still open. The pixels stay where they are, the job
+ * keeps them.
+ */
+static SnapshotJob *
+snapshot_job_new (void)
+{
+  SnapshotJob    *job = g_new0 (SnapshotJob, 1);
+  GHashTableIter  iter;
+  SnapshotPending *pending;
+  PixbufEntry    *entry;
+  guint           i;
+
+  job->images = g_array_new (FALSE, FALSE, sizeof (SnapshotImage));
+
+  g_hash_table_iter_init (&iter, pixbuf_entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+    snapshot_mark_used (entry->req->filename);
+
+  for (i = 0; snapshot && i < snapshot_get_n_images (snapshot); i++)
+    {
+      SnapshotImage image;
+
+      snapshot_get_image (snapshot, i, &image);
+      if (!g_hash_table_lookup (snapshot_pending, image.filename) &&
+	  g_hash_table_lookup (snapshot_used, image.filename) &&
+	  snapshot_lookup (snapshot, image.filename, &image))
+	g_array_append_val (job->images, image);
+    }
+
+  g_hash_table_iter_init (&iter, snapshot_pending);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pending))
+    {
+      SnapshotImage image;
+
+      image.filename  = pending->filename;
+      image.mtime     = pending->mtime;
+      image.file_size = pending->file_size;
+      image.width     = cairo_image_surface_get_width (pending->surface);
+      image.height    = cairo_image_surface_get_height (pending->surface);
+      image.stride    = cairo_image_surface_get_stride (pending->surface);
+      image.has_alpha = cairo_image_surface_get_format (pending->surface) == CAIRO_FORMAT_ARGB32;
+      image.pixels    = cairo_image_surface_get_data (pending->surface);
+      image.digest    = pending->digest;
+      image.slices    = NULL;
+      image.n_slices  = 0;
+      g_array_append_val (job->images, image);
+    }
+
+  job->last    = snapshot ? snapshot_ref (snapshot) : NULL;
+  job->pending = snapshot_pending;
+  snapshot_pending = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					    (GDestroyNotify) snapshot_pending_free);
+  g_hash_table_remove_all (snapshot_used);
+
+  return job;
+}
+
+/* Writes the new snapshot next to the old one and renames it over it, then
+ * maps it; in snapshot_pool, or at exit. The running server keeps its
+ * mapping of the old one as long as the surfaces use its pixels.
+ */
+static void
+snapshot_job_run (SnapshotJob *job)
+{
+  LOG ("writing %u images to the snapshot", job->images->len);
+
+  if (snapshot_write (snapshot_filename,
+		      (const SnapshotImage *) job->images->data, job->images->len,
+		      &job->error))
+    job->written = snapshot_open (snapshot_filename, &job->error);
+}
+
+static void
+snapshot_job_finish (SnapshotJob *job)
+{
+  if (job->written)
+    {
+      if (snapshot)
+	snapshot_unref (snapshot);
+      snapshot = job->written;
+    }
+
+  if (job->error)
+    {
+      g_warning ("%s", job->error->message);
+      g_error_free (job->error);
+    }
+
+  if (job->last)
+    snapshot_unref (job->last);
+  g_hash_table_destroy (job->pending);
+  g_array_free (job->images, TRUE);
+  g_free (job);
+
+  snapshot_writing = FALSE;
+}
+
+static gboolean
+snapshot_save_done (gpointer user_data)
+{
+  SnapshotJob *job;
+
+  while ((job = g_async_queue_try_pop (snapshots_done)))
+    snapshot_job_finish (job);
+
+  return FALSE;
+}
+
+static void
+snapshot_write_thread (gpointer data,
+		       gpointer user_data)
+{
+  snapshot_job_run (data);
+
+  g_async_queue_push (snapshots_done, data);
+  g_idle_add (snapshot_save_done, NULL);
+}
+
+/* Hands the images decoded since the last snapshot to snapshot_pool, so
+ * that the main loop is not blocked by the writing.
+ */
+static gboolean
+snapshot_save (gpointer user_data)
+{
+  snapshot_timeout = 0;
+
+  /* the images decoded in the meantime go into the next one */
+  if (snapshot_writing)
+    {
+      snapshot_timeout = g_timeout_add_seconds (SNAPSHOT_DELAY, snapshot_save, NULL);
+      return FALSE;
+    }
+
+  snapshot_writing = TRUE;
+  g_thread_pool_push (snapshot_pool, snapshot_job_new (), NULL);
+
+  return FALSE;
+}
+
+/* remembers a newly decoded image for the next snapshot, which is written
+ * once no image has been decoded for a while */
+static void
+snapshot_pending_add (PixbufSource *source)
+{
+  SnapshotPending *pending;
+
+  if (!snapshot_filename)
+    return;
+
+  pending = g_new0 (SnapshotPending, 1);
+  pending->filename  = g_strdup (source->filename);
+  pending->digest    = g_strdup (source->digest);
+  pending->mtime     = source->mtime;
+  pending->file_size = source->file_size;
+  pending->surface   = cairo_surface_reference (source->surface);
+  g_hash_table_replace (snapshot_pending, pending->filename, pending);
+
+  if (snapshot_timeout)
+    g_source_remove (snapshot_timeout);
+  snapshot_timeout = g_timeout_add_seconds (SNAPSHOT_DELAY, snapshot_save, NULL);
+}
+
+/* slices @load out of the decoded image of its file, decoding it first in
+ * the thread pool unless that has been done already */
+static void
+pixbuf_source_add_load (PixbufLoad *load)
+{
+  PixbufSource *source;
+
+  snapshot_mark_used (load->req->filename);
+
+  source = g_hash_table_lookup (pixbuf_sources, load->req->filename);
+  if (!source)
+    {
+      source = g_new0 (PixbufSource, 1);
+      source->filename = g_strdup (load->req->filename);
+      g_hash_table_insert (pixbuf_sources, source->filename, source);
+    }
+
+  source->loads = g_slist_prepend (source->loads, load);
+
+  if (source->busy)
+    return;
+
+  source->busy = TRUE;
+  if (source->decoded)
+    {
+      LOG ("slicing '%s' again", source->filename);
+
+      g_queue_delete_link (&decoded, source->link);
+      source->link = NULL;
+      decoded_size -= source->size;
+
+      g_async_queue_push (loads_done, source);
+      g_idle_add (pixbuf_load_done, NULL);
+    }
+  else if (pixbuf_source_from_snapshot (source))
+    {
+      LOG ("'%s' is in the snapshot", source->filename);
+
+      g_async_queue_push (loads_done, source);
+      g_idle_add (pixbuf_load_done, NULL);
+    }
+  else
+    {
+      source->prewarm = load->prewarm;
+      g_thread_pool_push (load_pool, source, NULL);
+    }
+}
+
+/* Creates the cache entry right away, the image is decoded by the thread
+ * pool and the replies to the clients waiting for it are sent from
+ * pixbuf_load_done()
+ */
+static PixbufOpenResponse *
+pixbuf_open_response_new (PixbufOpenRequest *req)
+{
+  PixbufEntry *entry;
+  PixbufLoad  *load;
+
+  /* revive an image that was released recently */
+  entry = g_hash_table_lookup (retained_hash, req);
+  if (entry)
+    {
+      LOG ("reviving '%s'", req->filename);
+      stats_revived++;
+
+      g_hash_table_remove (retained_hash, entry->req);
+      g_queue_delete_link (&retained, entry->link);
+      entry->link = NULL;
+      retained_size -= entry->size;
+
+      return &entry->rep;
+    }
+
+  stats_misses++;
+
+  entry = g_new0 (PixbufEntry, 1);
+  entry->rep.id = GPOINTER_TO_UINT (entry);
+  entry->req    = pixbuf_open_request_dup (req);
+  g_hash_table_insert (pixbuf_entries, entry, entry);
+
+  load = g_new0 (PixbufLoad, 1);
+  load->rep     = &entry->rep;
+  load->req     = entry->req;
+  load->prewarm = prewarming;
+
+  g_hash_table_insert (pixbuf_loads, &entry->rep, load);
+  pixbuf_source_add_load (load);
+
+  pixbuf_counter++;
+
+  return &entry->rep;
+}
+
+/* frees the pixmap @xid, and forgets all the parts using it, as all the
+ * parts of an atlas share the same pixmap */
+static void
+pixbuf_open_response_free_pixmap (PixbufOpenResponse *rep,
+				  guint32             xid)
+{
+  int i, j;
+
+  g_object_unref (gdk_xid_table_lookup (xid));
+  pixmap_counter--;
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+	if (rep->pixmap[i][j] == xid)
+	  rep->pixmap[i][j] = None;
+	if (rep->pixmask[i][j] == xid)
+	  rep->pixmask[i][j] = None;
+      }
+}
+
+/* whether the memory used by the pixmaps of @entry is accounted for with
+ * the entry, rather than by their tiles or by another entry */
+static gboolean
+pixbuf_entry_owns_pixmaps (const PixbufEntry *entry)
+{
+  return !entry->same && entry->rep.atlas_width;
+}
+
+static void
+pixbuf_open_response_destroy (PixbufOpenResponse *rep)
+{
+  PixbufEntry *entry = (PixbufEntry *) rep;
+  int          i, j;
+
+  if (!rep)
+    return;
+
+  /* the pixmaps belong to the other entry */
+  if (entry->same)
+    {
+      memset (rep->pixmap, 0, sizeof (rep->pixmap));
+      memset (rep->pixmask, 0, sizeof (rep->pixmask));
+    }
+  else if (!rep->atlas_width)
+    {
+      for (i = 0; i < 3; i++)
+	for (j = 0; j < 3; j++)
+	  if (rep->pixmap[i][j])
+	    tile_release (rep->pixmap[i][j]);
+
+      memset (rep->pixmap, 0, sizeof (rep->pixmap));
+      memset (rep->pixmask, 0, sizeof (rep->pixmask));
+    }
+
+  /* atlas or not, the entry can no longer be shared */
+  if (!entry->same && entry->content_key &&
+      g_hash_table_lookup (content_entries, entry->content_key) == entry)
+    g_hash_table_remove (content_entries, entry->content_key);
+
+  /* the page is only freed with the last atlas in it */
+  if (entry->page)
+    {
+      memset (rep->pixmap, 0, sizeof (rep->pixmap));
+      memset (rep->pixmask, 0, sizeof (rep->pixmask));
+      atlas_page_release (entry->page, &entry->page_rect);
+    }
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+	if (rep->pixmap[i][j])
+	  pixbuf_open_response_free_pixmap (rep, rep->pixmap[i][j]);
+	if (rep->pixmask[i][j])
+	  pixbuf_open_response_free_pixmap (rep, rep->pixmask[i][j]);
+      }
+
+  pixbuf_counter--;
+  if (pixbuf_entry_owns_pixmaps (entry))
+    pixmap_bytes -= entry->size;
+  g_hash_table_remove (pixbuf_entries, entry);
+
+  if (entry->same)
+    pixbuf_cache_remove (&entry->same->rep);
+
+  pixbuf_open_request_destroy (entry->req);
+  g_free (entry->content_key);
+  g_free (entry);
+}
+
+/* the memory the X server uses for the pixmaps of @rep, width x height x
+ * depth of every tile and mask; only the area taken in a shared page
+ * counts */
+static gsize
+pixbuf_open_response_size (const PixbufOpenResponse *rep)
+{
+  const PixbufEntry *entry = (const PixbufEntry *) rep;
+  gsize              size = 0;
+  gboolean           mask = FALSE;
+  int                i, j;
+
+  if (rep->atlas_width)
+    {
+      gsize pixels = rep->atlas_width * rep->atlas_height;
+
+      if (entry->page)
+	pixels = entry->page_rect.width * entry->page_rect.height;
+
+      for (i = 0; i < 3; i++)
+	for (j = 0; j < 3; j++)
+	  mask |= rep->pixmask[i][j] != None;
+
+      return pixels * (rep->depth > 16 ? 4 : rep->depth > 8 ? 2 : 1) +
+	     (mask ? (pixels + 7) / 8 : 0);
+    }
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+	gsize pixels = rep->tile_width[i][j] * rep->tile_height[i][j];
+
+	if (rep->pixmap[i][j])
+	  size += pixels * (rep->depth > 16 ? 4 : rep->depth > 8 ? 2 : 1);
+	if (rep->pixmask[i][j])
+	  size += (pixels + 7) / 8;
+      }
+
+  return size;
+}
+
+static void
+retained_remove_oldest (void)
+{
+  PixbufEntry *entry = g_queue_pop_head (&retained);
+
+  LOG ("expiring '%s'", entry->req->filename);
+
+  g_hash_table_remove (retained_hash, entry->req);
+  retained_size -= entry->size;
+  pixbuf_open_response_destroy (&entry->rep);
+}
+
+static gboolean
+retained_expire (gpointer user_data)
+{
+  time_t now = time (NULL);
+
+  retained_timeout = 0;
+
+  while (!g_queue_is_empty (&retained))
+    {
+      PixbufEntry *entry = g_queue_peek_head (&retained);
+
+      if (entry->released + retain_seconds > now)
 	{
-	  gint x0, x1;
+	  retained_timeout = g_timeout_add_seconds (entry->released + retain_seconds - now,
+						    retained_expire, NULL);
+	  break;
+	}
 
-	  switch (j)
-	    {
-	    case 0:
-	      x0 = 0;
-	      x1 = req->border_left;
-	      break;
-	    case 1:
-	      x0 = req->border_left;
-	      x1 = width - req->border_right;
-	      break;
-	    default:
-	      x0 = width - req->border_right;
-	      x1 = width;
-	      break;
-	    }
+      retained_remove_oldest ();
+    }
+
+  return FALSE;
+}
+
+static gint
+pixbuf_entry_compare_size (gconstpointer a,
+			   gconstpointer b)
+{
+  const PixbufEntry *ea = a;
+  const PixbufEntry *eb = b;
+
+  return ea->size < eb->size ? 1 : ea->size > eb->size ? -1 : 0;
+}
+
+/* logs the images using most of the X server memory, on SIGUSR1 or when
+ * the budget cannot be met */
+static gboolean
+pixbuf_report_usage (gpointer user_data)
+{
+  GList *entries, *l;
+  int    n;
+
+  g_message ("%zu bytes in %d images, %zu bytes unused, limit %d bytes",
+	     pixmap_bytes, g_hash_table_size (pixbuf_entries), retained_size, max_bytes);
+
+  entries = g_hash_table_get_keys (pixbuf_entries);
+  entries = g_list_sort (entries, pixbuf_entry_compare_size);
+  for (l = entries, n = 0; l && n < 10; l = l->next, n++)
+    {
+      PixbufEntry *entry = l->data;
+
+      g_message ("%10zu %s%s", entry->size, entry->req->filename,
+		 entry->link ? " (unused)" : "");
+    }
+  g_list_free (entries);
+
+  return TRUE;
+}
+
+/* evicts unused images, oldest first, until the total is within the limit */
+static void
+pixbuf_enforce_budget (void)
+{
+  static gboolean warned = FALSE;
+
+  if (max_bytes <= 0)
+    return;
+
+  while (pixmap_bytes > (gsize) max_bytes && !g_queue_is_empty (&retained))
+    retained_remove_oldest ();
+
+  if (pixmap_bytes > (gsize) max_bytes && !warned)
+    {
+      g_warning ("images in use exceed the limit of %d bytes", max_bytes);
+      pixbuf_report_usage (NULL);
+      warned = TRUE;
+    }
+  else if (pixmap_bytes <= (gsize) max_bytes)
+    warned = FALSE;
+}
+
+/* Called by the cache when the last reference is dropped. Instead of
+ * destroying the image right away, keep it around for a while in case it
+ * is opened again, e.g. when an application is restarted.
+ */
+static void
+pixbuf_open_response_release (PixbufOpenResponse *rep)
+{
+  PixbufEntry *entry = (PixbufEntry *) rep;
+
+  if (!entry->loaded || retain_seconds <= 0 || retain_bytes <= 0 ||
+      entry->size > (gsize) retain_bytes)
+    {
+      pixbuf_open_response_destroy (rep);
+      return;
+    }
+
+  entry->released = time (NULL);
+  g_queue_push_tail (&retained, entry);
+  entry->link = g_queue_peek_tail_link (&retained);
+  g_hash_table_insert (retained_hash, entry->req, entry);
+  retained_size += entry->size;
+
+  while (retained_size > (gsize) retain_bytes)
+    retained_remove_oldest ();
+
+  if (!retained_timeout)
+    retained_timeout = g_timeout_add_seconds (retain_seconds, retained_expire, NULL);
+}
+
+static PixbufOpenRequest *
+pixbuf_open_request_dup (const PixbufOpenRequest *req)
+{
+  return g_memdup (req, sizeof (*req) + strlen (req->filename) + 1);
+}
+
+static void
+pixbuf_open_request_destroy (PixbufOpenRequest *req)
+{
+  g_free (req);
+}
+
+static guint
+pixbuf_open_request_hash (gconstpointer key)
+{
+  const PixbufOpenRequest *req = key;
+  return g_str_hash (req->filename) ^
+	 (req->border_left | req->border_right << 8 |
+	  req->border_top << 16 | req->border_bottom << 24) ^
+	 REQUEST_DEPTH (req) << 4;
+}
+
+static gboolean
+pixbuf_open_request_equal (gconstpointer a, gconstpointer b)
+{
+  const PixbufOpenRequest *ra = a;
+  const PixbufOpenRequest *rb = b;
+
+  if (ra->border_left   != rb->border_left  ||
+      ra->border_right  != rb->border_right ||
+      ra->border_top    != rb->border_top   ||
+      ra->border_bottom != rb->border_bottom ||
+      REQUEST_DEPTH (ra) != REQUEST_DEPTH (rb))
+    return FALSE;
+
+  return g_str_equal (ra->filename, rb->filename);
+}
+
+static gboolean
+pixbuf_open_request_valid (const PixbufOpenRequest *req,
+			   gsize                    available)
+{
+  if (available < sizeof (PixbufOpenRequest) + 1 ||
+      req->base.op != PIXBUF_OP_OPEN ||
+      req->base.length < sizeof (PixbufOpenRequest) + 1 ||
+      req->base.length > available)
+    return FALSE;
+
+  /* the filename must be terminated within the request, and no longer
+   * than the engine sends */
+  return memchr (req->filename, '\0',
+		 MIN (req->base.length - sizeof (PixbufOpenRequest),
+		      PATH_MAX + 1)) != NULL;
+}
+
+/* watches for output only while there is some, and stops reading requests
+ * while a client does not read its replies */
+static void
+client_update_events (Client *client)
+{
+  struct epoll_event ev;
+
+  if (client->dispatching)
+    return;
+
+  memset (&ev, 0, sizeof (ev));
+  if (client->outbuf->len < CLIENT_OUTPUT_MAX)
+    ev.events |= EPOLLIN;
+  if (client->outbuf->len > client->outbuf_ofs)
+    ev.events |= EPOLLOUT;
+  ev.data.ptr = client;
+
+  if (ev.events == client->events)
+    return;
+
+  if (epoll_ctl (client_source->pollfd.fd, EPOLL_CTL_MOD, client->fd, &ev) < 0)
+    g_warning ("epoll_ctl: %s", strerror (errno));
+  else
+    client->events = ev.events;
+}
+
+/* queues @replen bytes of @rep as the reply to @seq, or just the header to
+ * signal an error if @rep is %NULL */
+static void
+write_reply (Client     *client,
+	     guint32     seq,
+	     const void *rep,
+	     gsize       replen)
+{
+  PixbufBaseResponse header;
+
+  if (!rep)
+    replen = 0;
+
+  header.seq    = seq;
+  header.length = sizeof (PixbufBaseResponse) + replen;
+
+  g_byte_array_append (client->outbuf, (guint8 *) &header, sizeof (header));
+  if (replen)
+    g_byte_array_append (client->outbuf, rep, replen);
+
+  client_update_events (client);
+}
+
+static PixbufOpenResponse *
+pixbuf_cache_insert (PixbufOpenRequest *req)
+{
+  PixbufOpenResponse *rep;
+
+  rep = g_cache_insert (pixmap_cache, req);
+  ((PixbufEntry *) rep)->refcnt++;
+
+  return rep;
+}
+
+static void
+pixbuf_cache_remove (PixbufOpenResponse *rep)
+{
+  ((PixbufEntry *) rep)->refcnt--;
+  g_cache_remove (pixmap_cache, rep);
+}
+
+static PendingReply *
+pending_reply_new (Client   *client,
+		   guint32   seq,
+		   gboolean  batch,
+		   guint     n_reps)
+{
+  PendingReply *reply;
+
+  reply = g_malloc0 (sizeof (PendingReply) + MAX (n_reps, 1) * sizeof (PixbufOpenResponse)
+		     - sizeof (PixbufOpenResponse));
+  reply->client = client;
+  reply->seq    = seq;
+  reply->batch  = batch;
+  reply->n_reps = n_reps;
+
+  return reply;
+}
+
+/* hands the cache reference taken for @reply over to its client */
+static void
+pending_reply_set (PendingReply       *reply,
+		   guint               index,
+		   PixbufOpenResponse *rep,
+		   gboolean            loaded)
+{
+  if (loaded && reply->client)
+    {
+      GHashTable *cleanup = reply->client->cleanup;
+      CacheNode  *node;
+
+      node = g_hash_table_lookup (cleanup, GUINT_TO_POINTER(rep->id));
+      if (!node)
+        g_hash_table_insert (cleanup, GUINT_TO_POINTER(rep->id), cache_node_new (rep));
+      else
+        cache_node_ref (node);
+
+      reply->reps[index] = *rep;
+    }
+  else
+    pixbuf_cache_remove (rep);
+}
+
+static void
+pending_reply_send (PendingReply *reply)
+{
+  Client *client = reply->client;
+
+  if (client)
+    {
+      if (reply->batch)
+	write_reply (client, reply->seq,
+		     reply->reps, reply->n_reps * sizeof (PixbufOpenResponse));
+      else
+	write_reply (client, reply->seq,
+		     reply->reps[0].id ? &reply->reps[0] : NULL,
+		     sizeof (PixbufOpenResponse));
+
+      client->pending = g_slist_remove (client->pending, reply);
+    }
+
+  g_free (reply);
+}
+
+/* Adds @req to the cache in the background, before any client asks for it.
+ * The reference is never dropped, so prewarmed images stay resident.
+ */
+static void
+pixbuf_prewarm (PixbufOpenRequest *req)
+{
+  PixbufOpenResponse *rep;
+  PixbufLoad         *load;
+
+  LOG ("prewarm: '%s'", req->filename);
+
+  prewarming = TRUE;
+  rep = pixbuf_cache_insert (req);
+  prewarming = FALSE;
+
+  load = g_hash_table_lookup (pixbuf_loads, rep);
+  if (load)
+    {
+      PixbufWaiter *waiter = g_new0 (PixbufWaiter, 1);
 
-	  if (x1-x0 > 0 && y1-y0 > 0)
-	    {
-	      extract_pixmap_single (pixbuf,
-				     i, j,
-				     x0, y0,
-				     x1-x0, y1-y0,
-				     rep);
-	    }
-	}
+      load->waiters = g_slist_prepend (load->waiters, waiter);
     }
+}
 
-  /* make sure the server has the pixmaps before the client */
-  gdk_flush ();
+static void
+pixbuf_open (PendingReply      *reply,
+	     guint              index,
+	     PixbufOpenRequest *req)
+{
+  PixbufOpenResponse *rep;
+  PixbufLoad         *load;
 
-  rep->width  = width;
-  rep->height = height;
+  LOG ("filename: '%s'", req->filename);
 
-  pixbuf_counter++;
-#ifdef DEBUG
-  for (i = 0; i < 3; i++)
+  if (reply->client)
+    reply->client->n_opens++;
+
+  rep = pixbuf_cache_insert (req);
+
+  load = g_hash_table_lookup (pixbuf_loads, rep);
+  if (load)
     {
-      char buf[4] = { '\0', };
-      for (j = 0; j < 3; j++)
-	buf[j] = rep->pixmap[i][j] ? 'X' : '.';
-      LOG ("  %s", buf);
+      PixbufWaiter *waiter = g_new (PixbufWaiter, 1);
+
+      waiter->reply = reply;
+      waiter->index = index;
+      load->waiters = g_slist_prepend (load->waiters, waiter);
+      reply->n_pending++;
+    }
+  else
+    {
+      stats_hits++;
+      pending_reply_set (reply, index, rep, TRUE);
     }
+}
 
-  LOG ("pixmaps: %d (%d)", pixmap_counter, pixbuf_counter);
-#endif
+/* Makes @entry use the pixmaps of @same, which has the same pixels, borders
+ * and depth, keeping a reference to it. It still has an id of its own, as
+ * the cache needs a value for each request, but the pixmaps and the memory
+ * they take are not duplicated.
+ */
+static void
+pixbuf_entry_share (PixbufEntry *entry,
+		    PixbufEntry *same)
+{
+  guint32 id = entry->rep.id;
 
-  return TRUE;
+  entry->rep    = same->rep;
+  entry->rep.id = id;
+  entry->same   = same;
+
+  /* revives it if it is unused */
+  pixbuf_cache_insert (same->req);
 }
 
-static PixbufOpenResponse *
-pixbuf_open_response_new (PixbufOpenRequest *req)
+/* uploads the pixmaps of @load and hands them to the requests waiting for
+ * them, adding the replies that are complete now to @done */
+static void
+pixbuf_load_finish (PixbufSource  *source,
+		    PixbufLoad    *load,
+		    GSList       **done)
 {
-  PixbufOpenResponse *rep = NULL;
-  GdkPixbuf         *pixbuf;
-  GError            *err = NULL;
+  PixbufOpenResponse *rep = load->rep;
+  gboolean            loaded = FALSE;
+  GSList             *l;
 
-  pixbuf = gdk_pixbuf_new_from_file (req->filename, &err);
-  if (pixbuf)
+  if (source->decoded)
     {
-      rep = g_new0 (PixbufOpenResponse, 1);
-      rep->id = GPOINTER_TO_UINT (rep);
+      GTimer      *timer = g_timer_new ();
+      PixbufEntry *entry = (PixbufEntry *) rep;
+      PixbufEntry *same;
 
-      if (!extract_pixmaps (pixbuf, req, rep, &err))
+      entry->content_key = g_strdup_printf ("%s/%u/%u/%u/%u/%u", source->digest,
+					    load->req->border_left, load->req->border_right,
+					    load->req->border_top, load->req->border_bottom,
+					    REQUEST_DEPTH (load->req));
+
+      same = g_hash_table_lookup (content_entries, entry->content_key);
+      if (same && same->loaded)
 	{
-	  g_free (rep);
-	  rep = NULL;
+	  LOG ("'%s' is the same as '%s'", load->req->filename, same->req->filename);
+	  pixbuf_entry_share (entry, same);
+	  loaded = TRUE;
 	}
-      g_object_unref (pixbuf);
+      else
+	{
+	  pixbuf_source_convert (source);
+	  loaded = extract_pixmaps (source, load->req, rep, &load->error);
+	  if (loaded && !same)
+	    g_hash_table_insert (content_entries, entry->content_key, entry);
+	}
+      stats_upload_time += g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
     }
+  else
+    load->error = g_error_copy (source->error);
 
-  if (!rep)
+  if (loaded)
     {
-      g_warning ("%s: %s", req->filename, err->message);
-      g_error_free (err);
-      return NULL;
+      PixbufEntry *entry = (PixbufEntry *) rep;
+
+      entry->loaded = TRUE;
+      entry->size   = entry->same ? 0 : pixbuf_open_response_size (rep);
+      if (pixbuf_entry_owns_pixmaps (entry))
+	pixmap_bytes += entry->size;
+      pixbuf_enforce_budget ();
     }
+  else
+    g_warning ("%s: %s", load->req->filename, load->error->message);
 
-  return rep;
+  g_hash_table_remove (pixbuf_loads, rep);
+
+  /* on failure this drops the last reference to rep, and the loading
+   * request is owned by the cache entry */
+  load->waiters = g_slist_reverse (load->waiters);
+  for (l = load->waiters; l; l = l->next)
+    {
+      PixbufWaiter *waiter = l->data;
+
+      if (!waiter->reply)
+	{
+	  /* prewarmed images keep their reference */
+	  if (!loaded)
+	    pixbuf_cache_remove (rep);
+	}
+      else
+	{
+	  pending_reply_set (waiter->reply, waiter->index, rep, loaded);
+	  if (--waiter->reply->n_pending == 0)
+	    *done = g_slist_prepend (*done, waiter->reply);
+	}
+      g_free (waiter);
+    }
+  g_slist_free (load->waiters);
+
+  if (load->error)
+    g_error_free (load->error);
+  g_free (load);
 }
 
-static void
-pixbuf_open_response_destroy (PixbufOpenResponse *rep)
+/* uploads the images decoded by the thread pool and answers the requests
+ * that are complete now, with a single round trip to the X server */
+static gboolean
+pixbuf_load_done (gpointer user_data)
 {
-  GdkPixmap *pixmap;
-  int        i, j;
+  GSList       *done = NULL;
+  PixbufSource *source;
 
-  if (!rep)
-    return;
+  while ((source = g_async_queue_try_pop (loads_done)))
+    {
+      GSList *loads, *l;
 
-  for (i = 0; i < 3; i++)
-    for (j = 0; j < 3; j++)
-      {
-	if (rep->pixmap[i][j])
-	  {
-	    pixmap = gdk_xid_table_lookup (rep->pixmap[i][j]);
-	    g_object_unref (pixmap);
-	    rep->pixmap[i][j] = None;
+      if (!source->decoded)
+	{
+	  stats_decode_time += source->decode_time;
+	  source->decoded = source->surface != NULL;
+	  if (source->decoded && !source->snapshotted)
+	    snapshot_pending_add (source);
+	}
 
-	    pixmap_counter--;
-	  }
+      /* every border set asked for in the meantime */
+      loads = g_slist_reverse (source->loads);
+      source->loads = NULL;
+      for (l = loads; l; l = l->next)
+	pixbuf_load_finish (source, l->data, &done);
+      g_slist_free (loads);
 
-	if (rep->pixmask[i][j])
-	  {
-	    pixmap = gdk_xid_table_lookup (rep->pixmask[i][j]);
-	    g_object_unref (pixmap);
-	    rep->pixmask[i][j] = None;
+      pixbuf_source_release (source);
+    }
 
-	    pixmap_counter--;
-	  }
-      }
+  if (done)
+    {
+      GTimer *timer = g_timer_new ();
 
-  pixbuf_counter--;
+      /* make sure the server has the pixmaps before the client */
+      gdk_flush ();
+      stats_upload_time += g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
 
-  g_free (rep);
-}
+      done = g_slist_reverse (done);
+      g_slist_foreach (done, (GFunc) pending_reply_send, NULL);
+      g_slist_free (done);
+    }
 
-static PixbufOpenRequest *
-pixbuf_open_request_dup (const PixbufOpenRequest *req)
-{
-  return g_memdup (req, sizeof (*req) + strlen (req->filename) + 1);
+  return FALSE;
 }
 
+/* replies right away if all images were cached, otherwise once they have
+ * been loaded */
 static void
-pixbuf_open_request_destroy (PixbufOpenRequest *req)
+pending_reply_queue (PendingReply *reply)
 {
-  g_free (req);
+  if (reply->n_pending == 0)
+    pending_reply_send (reply);
+  else
+    reply->client->pending = g_slist_prepend (reply->client->pending, reply);
 }
 
-static guint
-pixbuf_open_request_hash (gconstpointer key)
+static void
+count_refs (gpointer key,
+	    gpointer value,
+	    gpointer user_data)
 {
-  const PixbufOpenRequest *req = key;
-  return g_str_hash (req->filename);
+  CacheNode *node = value;
+  guint     *n_refs = user_data;
+
+  *n_refs += node->refcnt;
 }
 
-static gboolean
-pixbuf_open_request_equal (gconstpointer a, gconstpointer b)
+static void
+write_stats_reply (Client  *client,
+		   guint32  seq)
 {
-  const PixbufOpenRequest *ra = a;
-  const PixbufOpenRequest *rb = b;
+  PixbufStatsResponse  stats = { 0, };
+  GByteArray          *reply;
+  GHashTableIter       iter;
+  gpointer             key;
+  GSList              *l;
+
+  stats.n_clients      = g_slist_length (clients);
+  stats.n_images       = g_hash_table_size (pixbuf_entries);
+  stats.hits           = stats_hits;
+  stats.misses         = stats_misses;
+  stats.revived        = stats_revived;
+  stats.decode_usec    = stats_decode_time * G_USEC_PER_SEC;
+  stats.upload_usec    = stats_upload_time * G_USEC_PER_SEC;
+  stats.pixmap_bytes   = pixmap_bytes;
+  stats.retained_bytes = retained_size;
+
+  reply = g_byte_array_new ();
+  g_byte_array_append (reply, (guint8 *) &stats, sizeof (stats));
+
+  for (l = clients; l; l = l->next)
+    {
+      Client            *client = l->data;
+      PixbufStatsClient  rec = { 0, };
 
-  if (!g_str_equal (ra->filename, rb->filename))
-    return FALSE;
+      rec.pid      = client->pid;
+      rec.n_opens  = client->n_opens;
+      rec.n_images = g_hash_table_size (client->cleanup);
+      g_hash_table_foreach (client->cleanup, count_refs, &rec.n_refs);
 
-  return TRUE;
+      g_byte_array_append (reply, (guint8 *) &rec, sizeof (rec));
+    }
+
+  g_hash_table_iter_init (&iter, pixbuf_entries);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      PixbufEntry      *entry = key;
+      gsize             len = strlen (entry->req->filename) + 1;
+      gsize             ofs = reply->len;
+      PixbufStatsImage *rec;
+
+      /* the filenames are at most PATH_MAX, see pixbuf_open_request_valid() */
+      g_byte_array_set_size (reply, ofs + PIXBUF_PROTO_ALIGN (sizeof (PixbufStatsImage) + len));
+      rec = (PixbufStatsImage *) (reply->data + ofs);
+      memset (rec, 0, reply->len - ofs);
+
+      rec->length = reply->len - ofs;
+      rec->refcnt = entry->refcnt;
+      rec->bytes  = entry->size;
+      memcpy (rec->filename, entry->req->filename, len);
+    }
+
+  write_reply (client, seq, reply->data, reply->len);
+  g_byte_array_free (reply, TRUE);
 }
 
-static ssize_t
-process_buffer (int fd, char *buf, ssize_t buflen, gpointer user_data)
+static gssize
+process_buffer (Client *client, char *buf, gsize buflen)
 {
-  GHashTable *cleanup = user_data;
+  GHashTable *cleanup = client->cleanup;
   const PixbufBaseRequest *base = (const PixbufBaseRequest *) buf;
-  ssize_t n;
 
   if (buflen < sizeof (PixbufBaseRequest) || buflen < base->length)
     return 0;
 
+  if (base->length < sizeof (PixbufBaseRequest))
+    {
+      g_warning ("invalid request length %d", base->length);
+      return -1;
+    }
+
   if (base->op == PIXBUF_OP_OPEN)
     {
       PixbufOpenRequest  *req = (PixbufOpenRequest *) base;
-      PixbufOpenResponse *rep;
+      PendingReply       *reply;
 
-      if (base->length < sizeof (PixbufOpenRequest) + 1)
+      if (!pixbuf_open_request_valid (req, base->length))
 	{
-	  char buf[1] = { '-' };
+	  write_reply (client, base->seq, NULL, 0);
 
-	  write (fd, buf, 1);
-
-	  g_warning ("short request, only %d bytes, expected at least %zu",
-		     base->length, sizeof (PixbufOpenRequest) + 1);
+	  g_warning ("malformed request, %d bytes", base->length);
 	  return -1;
 	}
 
-      LOG ("filename: '%s'", req->filename);
+      reply = pending_reply_new (client, base->seq, FALSE, 1);
+      pixbuf_open (reply, 0, req);
+      pending_reply_queue (reply);
+    }
+  else if (base->op == PIXBUF_OP_OPEN_BATCH)
+    {
+      PixbufOpenBatchRequest *batch = (PixbufOpenBatchRequest *) base;
+      PendingReply           *reply;
+      gsize                   ofs;
+      int                     i;
 
-      rep = g_cache_insert (pixmap_cache, req);
-      if (rep)
+      if (base->length < sizeof (PixbufOpenBatchRequest) ||
+	  batch->n_requests > PIXBUF_OPEN_BATCH_MAX)
 	{
-	  CacheNode *node;
+	  g_warning ("invalid batch request, %d bytes for %d images",
+		     base->length, base->length < sizeof (PixbufOpenBatchRequest) ? 0 : batch->n_requests);
+	  return -1;
+	}
 
-	  node = g_hash_table_lookup (cleanup, GUINT_TO_POINTER(rep->id));
-	  if (!node)
-            g_hash_table_insert (cleanup, GUINT_TO_POINTER(rep->id), cache_node_new (rep));
-	  else
-            cache_node_ref (node);
+      /* validate everything first, to not leave a partial reply behind */
+      ofs = sizeof (PixbufOpenBatchRequest);
+      for (i = 0; i < batch->n_requests; i++)
+	{
+	  PixbufOpenRequest  *req = (PixbufOpenRequest *) (buf + ofs);
 
-	  /* write reply */
-	  n = write (fd, rep, sizeof (*rep));
-	  if (n < 0)
+	  if (!pixbuf_open_request_valid (req, base->length - MIN (ofs, base->length)))
 	    {
-	      g_warning ("write: %s", strerror (errno));
-	    }
-	  else if (n < sizeof (*rep))
-	    {
-	      g_warning ("short write, wrote only %zd of %zu bytes", n, sizeof (*rep));
+	      g_warning ("malformed batch request, image %d of %d",
+			 i + 1, batch->n_requests);
+	      return -1;
 	    }
+
+	  ofs += PIXBUF_PROTO_ALIGN (req->base.length);
 	}
-      else
-	{
-	  char buf[1] = { '-' };
 
-	  write (fd, buf, 1);
+      reply = pending_reply_new (client, base->seq, TRUE, batch->n_requests);
+
+      ofs = sizeof (PixbufOpenBatchRequest);
+      for (i = 0; i < batch->n_requests; i++)
+	{
+	  PixbufOpenRequest  *req = (PixbufOpenRequest *) (buf + ofs);
 
-	  g_cache_remove (pixmap_cache, rep);
+	  pixbuf_open (reply, i, req);
+	  ofs += PIXBUF_PROTO_ALIGN (req->base.length);
 	}
+
+      /* the images still being loaded are flushed together by
+       * pixbuf_load_done() */
+      pending_reply_queue (reply);
     }
   else if (base->op == PIXBUF_OP_CLOSE)
     {
@@ -439,6 +2358,10 @@ process_buffer (int fd, char *buf, ssize_t buflen, gpointer user_data)
 
       /* no reply */
     }
+  else if (base->op == PIXBUF_OP_STATS)
+    {
+      write_stats_reply (client, base->seq);
+    }
   else
     {
       g_warning ("unknown opcode: %d", base->op);
@@ -447,119 +2370,323 @@ process_buffer (int fd, char *buf, ssize_t buflen, gpointer user_data)
   return base->length;
 }
 
+/* reads at most CLIENT_READ_SIZE bytes and handles the complete requests,
+ * returns %FALSE if the client is gone or sent garbage */
 static gboolean
-client_sock_callback (GIOChannel   *channel,
-		      GIOCondition  cond,
-		      gpointer      user_data)
+client_read (Client *client)
 {
-  int         fd;
-  static char buf[sizeof (PixbufOpenRequest) + PATH_MAX + 1];
-  static int  buflen = 0;
-  ssize_t     n, ofs;
+  GByteArray *inbuf = client->inbuf;
+  guint       len = inbuf->len;
+  gssize      n, ofs;
+  int         err;
 
-  if (cond & (G_IO_HUP | G_IO_ERR))
-    {
-      if (cond & G_IO_ERR)
-	g_warning ("client error");
-      return FALSE;
-    }
+  g_byte_array_set_size (inbuf, len + CLIENT_READ_SIZE);
+  n = read (client->fd, inbuf->data + len, CLIENT_READ_SIZE);
+  err = errno;
+  g_byte_array_set_size (inbuf, len + MAX (n, 0));
 
-  /* read request */
-  fd = g_io_channel_unix_get_fd (channel);
+  if (n == 0)
+    return FALSE;
 
-  n = read (fd, buf + buflen, sizeof (buf) - buflen);
   if (n < 0)
     {
-      int err = errno;
-
-      g_warning ("read: %s", strerror (errno));
-
       if (err == EAGAIN || err == EINTR)
 	return TRUE;
 
+      g_warning ("read: %s", strerror (err));
       return FALSE;
     }
-  buflen += n;
 
   ofs = 0;
-  while (ofs < buflen)
+  while (ofs < inbuf->len)
     {
-      n = process_buffer (fd, buf + ofs, buflen - ofs, user_data);
+      n = process_buffer (client, (char *) inbuf->data + ofs, inbuf->len - ofs);
       if (n < 0)
 	return FALSE;
+      if (n == 0)
+	break;
 
       ofs += n;
     }
 
-  if (ofs != buflen)
-    memmove (buf, buf + ofs, buflen - ofs);
-  buflen -= ofs;
+  g_byte_array_remove_range (inbuf, 0, ofs);
 
   return TRUE;
 }
 
-static void
-client_sock_removed (gpointer user_data)
+static gboolean
+client_write (Client *client)
 {
-  GHashTable *cleanup = user_data;
+  GByteArray *outbuf = client->outbuf;
+  ssize_t     n;
 
-  LOG ("client removed");
+  while (client->outbuf_ofs < outbuf->len)
+    {
+      n = send (client->fd, outbuf->data + client->outbuf_ofs,
+		outbuf->len - client->outbuf_ofs, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno == EAGAIN)
+	    break;
 
-  g_hash_table_destroy (cleanup);
+	  g_warning ("write: %s", strerror (errno));
+	  return FALSE;
+	}
 
-  LOG ("pixmaps: %d (%d)", pixmap_counter, pixbuf_counter);
+      client->outbuf_ofs += n;
+    }
+
+  if (client->outbuf_ofs == outbuf->len)
+    {
+      g_byte_array_set_size (outbuf, 0);
+      client->outbuf_ofs = 0;
+    }
+
+  return TRUE;
 }
 
 static void
 cleanup_pixmap_destroy (gpointer data)
 {
   CacheNode *node = data;
-  g_cache_remove (pixmap_cache, node->rep);
+  pixbuf_cache_remove (node->rep);
   cache_node_free (node);
 }
 
-static gboolean
-main_sock_callback (GIOChannel   *channel,
-		    GIOCondition  cond,
-		    gpointer      user_data)
+static Client *
+client_new (int fd)
+{
+  struct epoll_event  ev;
+  Client             *client;
+
+  client = g_new0 (Client, 1);
+  client->fd      = fd;
+  client->events  = EPOLLIN;
+  client->inbuf   = g_byte_array_new ();
+  client->outbuf  = g_byte_array_new ();
+  client->cleanup = g_hash_table_new_full (NULL, NULL, NULL, cleanup_pixmap_destroy);
+#ifdef SO_PEERCRED
+  {
+    struct ucred cred;
+    socklen_t    len = sizeof (cred);
+
+    if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+      client->pid = cred.pid;
+  }
+#endif
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events   = client->events;
+  ev.data.ptr = client;
+  if (epoll_ctl (client_source->pollfd.fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      g_warning ("epoll_ctl: %s", strerror (errno));
+      g_byte_array_free (client->inbuf, TRUE);
+      g_byte_array_free (client->outbuf, TRUE);
+      g_hash_table_destroy (client->cleanup);
+      g_free (client);
+      return NULL;
+    }
+
+  clients = g_slist_prepend (clients, client);
+  n_clients++;
+
+  return client;
+}
+
+static void
+client_free (Client *client)
+{
+  GSList *l;
+
+  LOG ("client removed");
+
+  epoll_ctl (client_source->pollfd.fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close (client->fd);
+
+  clients = g_slist_remove (clients, client);
+  n_clients--;
+
+  /* the images are still loaded for the cache, but nobody gets a reply */
+  for (l = client->pending; l; l = l->next)
+    {
+      PendingReply *reply = l->data;
+
+      reply->client = NULL;
+    }
+  g_slist_free (client->pending);
+
+  g_hash_table_destroy (client->cleanup);
+  g_byte_array_free (client->inbuf, TRUE);
+  g_byte_array_free (client->outbuf, TRUE);
+  g_free (client);
+
+  LOG ("pixmaps: %d (%d), %zu bytes", pixmap_counter, pixbuf_counter, pixmap_bytes);
+}
+
+/* handles one round of @events for @client, the replies to the requests
+ * read are written right away */
+static void
+client_dispatch (Client   *client,
+		 guint32   events)
+{
+  gboolean alive = TRUE;
+
+  client->dispatching = TRUE;
+
+  if (events & EPOLLIN)
+    alive = client_read (client);
+  else if (events & (EPOLLHUP | EPOLLERR))
+    {
+      if (events & EPOLLERR)
+	g_warning ("client error");
+      alive = FALSE;
+    }
+
+  if (alive && client->outbuf->len > client->outbuf_ofs)
+    alive = client_write (client);
+
+  client->dispatching = FALSE;
+
+  if (alive)
+    client_update_events (client);
+  else
+    client_free (client);
+}
+
+static void
+accept_clients (int listen_fd)
 {
   struct sockaddr fromaddr;
-  socklen_t       fromlen = sizeof(fromlen);
+  socklen_t       fromlen;
   int             fd;
-  GHashTable     *cleanup;
 
-  if (cond & (G_IO_HUP | G_IO_ERR))
+  for (;;)
     {
-      if (cond & G_IO_HUP)
-	g_warning ("hangup");
-      if (cond & G_IO_ERR)
-	g_warning ("error");
-      return FALSE;
+      fromlen = sizeof (fromaddr);
+      fd = accept (listen_fd, &fromaddr, &fromlen);
+      if (fd == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    g_warning ("accept: %s", strerror (errno));
+	  return;
+	}
+
+      LOG ("client fd = %d", fd);
+
+      fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+      fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+      if (!client_new (fd))
+	close (fd);
+    }
+}
+
+static gboolean
+client_source_prepare (GSource *source,
+		       gint    *timeout)
+{
+  *timeout = -1;
+  return FALSE;
+}
+
+static gboolean
+client_source_check (GSource *source)
+{
+  ClientSource *csource = (ClientSource *) source;
+
+  return (csource->pollfd.revents & G_IO_IN) != 0;
+}
+
+static gboolean
+client_source_dispatch (GSource     *source,
+			GSourceFunc  callback,
+			gpointer     user_data)
+{
+  ClientSource *csource = (ClientSource *) source;
+  int           i, n;
+
+  /* room for every socket, so all the ready ones are handled at once */
+  if (csource->n_events < n_clients + 1)
+    {
+      csource->n_events = MAX (n_clients + 1, 2 * csource->n_events);
+      csource->events = g_renew (struct epoll_event, csource->events, csource->n_events);
     }
 
-  fd = accept (g_io_channel_unix_get_fd (channel), &fromaddr, &fromlen);
-  if (fd == -1)
+  n = epoll_wait (csource->pollfd.fd, csource->events, csource->n_events, 0);
+  if (n < 0)
     {
-      g_warning ("accept: %s", strerror (errno));
+      if (errno != EINTR)
+	g_warning ("epoll_wait: %s", strerror (errno));
       return TRUE;
     }
 
-  LOG ("client fd = %d", fd);
-
-  cleanup = g_hash_table_new_full (NULL, NULL, NULL, cleanup_pixmap_destroy);
+  for (i = 0; i < n; i++)
+    {
+      struct epoll_event *ev = &csource->events[i];
 
-  channel = g_io_channel_unix_new (fd);
-  g_io_channel_set_close_on_unref (channel, TRUE);
-  g_io_add_watch_full (channel,
-		       G_PRIORITY_DEFAULT,
-		       G_IO_IN|G_IO_ERR|G_IO_HUP,
-		       client_sock_callback, cleanup,
-		       client_sock_removed);
-  g_io_channel_unref (channel);
+      if (ev->data.ptr)
+	client_dispatch (ev->data.ptr, ev->events);
+      else if (ev->events & (EPOLLHUP | EPOLLERR))
+	{
+	  g_warning ("error on the listening socket");
+	  epoll_ctl (csource->pollfd.fd, EPOLL_CTL_DEL, csource->listen_fd, NULL);
+	}
+      else
+	accept_clients (csource->listen_fd);
+    }
 
   return TRUE;
 }
 
+static void
+client_source_finalize (GSource *source)
+{
+  ClientSource *csource = (ClientSource *) source;
+
+  close (csource->pollfd.fd);
+  g_free (csource->events);
+}
+
+static GSourceFuncs client_source_funcs =
+{
+  client_source_prepare,
+  client_source_check,
+  client_source_dispatch,
+  client_source_finalize
+};
+
+static ClientSource *
+client_source_new (int listen_fd)
+{
+  ClientSource       *csource;
+  struct epoll_event  ev;
+  int                 epfd;
+
+  epfd = epoll_create (64);
+  if (epfd < 0)
+    g_error ("epoll_create: %s", strerror (errno));
+  fcntl (epfd, F_SETFD, FD_CLOEXEC);
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events   = EPOLLIN;
+  ev.data.ptr = NULL;           /* the listening socket */
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+    g_error ("epoll_ctl: %s", strerror (errno));
+
+  csource = (ClientSource *) g_source_new (&client_source_funcs, sizeof (ClientSource));
+  csource->listen_fd      = listen_fd;
+  csource->pollfd.fd      = epfd;
+  csource->pollfd.events  = G_IO_IN;
+  g_source_add_poll (&csource->source, &csource->pollfd);
+
+  return csource;
+}
+
 static int
 get_display_depth (void)
 {
@@ -580,15 +2707,58 @@ main (int argc, char **argv)
 {
   struct sockaddr_un  sun;
   int                 fd;
-  GIOChannel         *channel;
   struct sigaction    act;
   sigset_t            empty_mask;
+  GIOChannel         *channel;
+  GOptionContext     *context;
+  GError             *error = NULL;
+  char              **prewarm = NULL;
+  char              **prewarm_gtkrc = NULL;
+  char              **pack_filenames = NULL;
+  GPtrArray          *prewarm_requests;
+  guint               i;
+  GOptionEntry        entries[] =
+  {
+    { "prewarm", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &prewarm,
+      "Load the images listed in FILE at startup and keep them loaded", "FILE" },
+    { "prewarm-gtkrc", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &prewarm_gtkrc,
+      "Load the images used by the gtkrc FILE at startup and keep them loaded", "FILE" },
+    { "retain-time", 0, 0, G_OPTION_ARG_INT, &retain_seconds,
+      "Keep unused images for up to SECONDS in case they are opened again (default: 60, 0 to disable)", "SECONDS" },
+    { "retain-size", 0, 0, G_OPTION_ARG_INT, &retain_bytes,
+      "Keep at most BYTES of unused images (default: 4194304)", "BYTES" },
+    { "max-size", 0, 0, G_OPTION_ARG_INT, &max_bytes,
+      "Unload unused images early to keep the X server memory used below BYTES", "BYTES" },
+    { "atlas", 0, 0, G_OPTION_ARG_NONE, &atlas_mode,
+      "Upload every image as a single pixmap and mask instead of one for each part", NULL },
+    { "decoded-size", 0, 0, G_OPTION_ARG_INT, &decoded_bytes,
+      "Keep up to BYTES of decoded images to slice them with other borders (default: 4194304)", "BYTES" },
+    { "pack", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &pack_filenames,
+      "Use the images of the theme pack FILE made by sapwood-pack", "FILE" },
+    { "snapshot", 0, 0, G_OPTION_ARG_FILENAME, &snapshot_filename,
+      "Keep the decoded images in FILE for the next start of the server", "FILE" },
+    { NULL }
+  };
 
 #ifdef ENABLE_DEBUG
   if (g_getenv ("SAPWOOD_SERVER_DEBUG"))
     enable_debug = TRUE;
 #endif
 
+#if !GLIB_CHECK_VERSION(2,32,0)
+  /* images are decoded by a thread pool */
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+#endif
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  /* leave the gdk options to gdk_init() */
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("%s", error->message);
+  g_option_context_free (context);
+
   gdk_init (&argc, &argv);
 
   server_depth = get_display_depth ();
@@ -632,29 +2802,109 @@ main (int argc, char **argv)
   g_atexit (atexit_handler);
 #endif
 
-  if (listen (fd, 5) < 0)
+  if (listen (fd, SOMAXCONN) < 0)
     g_error ("listen: %s", strerror (errno));
 
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  client_source = client_source_new (fd);
+  g_source_attach (&client_source->source, NULL);
+
+  if (pipe (signal_pipe) < 0)
+    g_error ("pipe: %s", strerror (errno));
+  for (i = 0; i < 2; i++)
+    {
+      fcntl (signal_pipe[i], F_SETFL, fcntl (signal_pipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl (signal_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
 
-  channel = g_io_channel_unix_new (fd);
-  g_io_add_watch (channel, G_IO_IN|G_IO_HUP|G_IO_ERR,
-		  main_sock_callback, NULL);
+  channel = g_io_channel_unix_new (signal_pipe[0]);
+  g_io_add_watch (channel, G_IO_IN, signal_pipe_callback, NULL);
   g_io_channel_unref (channel);
 
   sigemptyset (&empty_mask);
   act.sa_handler = signal_handler;
   act.sa_mask    = empty_mask;
-  act.sa_flags   = 0;
+  act.sa_flags   = SA_RESTART;
   sigaction (SIGTERM, &act, 0);
-  sigaction (SIGHUP,  &act, 0);
   sigaction (SIGINT,  &act, 0);
+  sigaction (SIGUSR1, &act, 0);
+  signal (SIGHUP, SIG_IGN);
 
   pixmap_cache = g_cache_new ((GCacheNewFunc)pixbuf_open_response_new,
-			      (GCacheDestroyFunc)pixbuf_open_response_destroy,
+			      (GCacheDestroyFunc)pixbuf_open_response_release,
 			      (GCacheDupFunc)pixbuf_open_request_dup,
 			      (GCacheDestroyFunc)pixbuf_open_request_destroy,
 			      pixbuf_open_request_hash, g_direct_hash, pixbuf_open_request_equal);
 
+  pixbuf_loads = g_hash_table_new (NULL, NULL);
+  pixbuf_sources = g_hash_table_new (g_str_hash, g_str_equal);
+  retained_hash = g_hash_table_new (pixbuf_open_request_hash, pixbuf_open_request_equal);
+  pixbuf_entries = g_hash_table_new (NULL, NULL);
+  content_entries = g_hash_table_new (g_str_hash, g_str_equal);
+  tiles = g_hash_table_new (g_str_hash, g_str_equal);
+  tiles_by_xid = g_hash_table_new (NULL, NULL);
+  snapshot_pending = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					    (GDestroyNotify) snapshot_pending_free);
+  snapshot_used = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  snapshots_done = g_async_queue_new ();
+  snapshot_pool = g_thread_pool_new (snapshot_write_thread, NULL, 1, FALSE, NULL);
+  loads_done = g_async_queue_new ();
+  load_pool = g_thread_pool_new (pixbuf_load_thread, NULL,
+				 MAX (sysconf (_SC_NPROCESSORS_ONLN), 1),
+				 FALSE, NULL);
+  g_thread_pool_set_sort_function (load_pool, pixbuf_load_compare, NULL);
+
+  for (i = 0; pack_filenames && pack_filenames[i]; i++)
+    {
+      Snapshot *pack = snapshot_open (pack_filenames[i], &error);
+
+      if (pack)
+	packs = g_slist_append (packs, pack);
+      else
+	{
+	  g_warning ("%s", error->message);
+	  g_clear_error (&error);
+	}
+    }
+  g_strfreev (pack_filenames);
+
+  if (snapshot_filename)
+    {
+      snapshot = snapshot_open (snapshot_filename, &error);
+      if (!snapshot)
+	{
+	  /* there is none before the first run */
+	  if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+	    g_warning ("%s", error->message);
+	  g_clear_error (&error);
+	}
+    }
+
+  /* decoded by the thread pool while clients are already served */
+  prewarm_requests = g_ptr_array_new ();
+  for (i = 0; prewarm && prewarm[i]; i++)
+    if (!prewarm_parse_manifest (prewarm[i], prewarm_requests, &error))
+      {
+	g_warning ("%s", error->message);
+	g_clear_error (&error);
+      }
+  for (i = 0; prewarm_gtkrc && prewarm_gtkrc[i]; i++)
+    if (!prewarm_parse_gtkrc (prewarm_gtkrc[i], prewarm_requests, &error))
+      {
+	g_warning ("%s", error->message);
+	g_clear_error (&error);
+      }
+  for (i = 0; i < prewarm_requests->len; i++)
+    {
+      pixbuf_prewarm (g_ptr_array_index (prewarm_requests, i));
+      g_free (g_ptr_array_index (prewarm_requests, i));
+    }
+  LOG ("prewarming %d images", prewarm_requests->len);
+  g_ptr_array_free (prewarm_requests, TRUE);
+  g_strfreev (prewarm);
+  g_strfreev (prewarm_gtkrc);
+
 #ifdef ENABLE_DEBUG
   if (enable_debug)
     {
@@ -666,6 +2916,22 @@ main (int argc, char **argv)
   g_main_loop_run (main_loop);
   g_main_loop_unref (main_loop);
 
+  /* finish the one being written, then write the images decoded since */
+  g_thread_pool_free (snapshot_pool, FALSE, TRUE);
+  snapshot_save_done (NULL);
+  if (snapshot_timeout)
+    {
+      SnapshotJob *job;
+
+      g_source_remove (snapshot_timeout);
+      job = snapshot_job_new ();
+      snapshot_job_run (job);
+      snapshot_job_finish (job);
+    }
+
+  g_source_destroy (&client_source->source);
+  g_source_unref (&client_source->source);
+
   close (fd);
   return 0;
 }
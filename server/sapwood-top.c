@@ -0,0 +1,228 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/* sapwood-top: shows the statistics of the running sapwood-server */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gdk/gdk.h>
+
+#include "sapwood-client.h"
+#include "sapwood-proto.h"
+
+static gint       interval = 2;
+static gint       n_lines  = 20;
+static gchar     *sort_by  = NULL;
+static gboolean   once     = FALSE;
+static GMainLoop *loop     = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "interval", 'd', 0, G_OPTION_ARG_INT, &interval,
+    "Update every SECONDS (default: 2)", "SECONDS" },
+  { "lines", 'n', 0, G_OPTION_ARG_INT, &n_lines,
+    "Show the first N images (default: 20)", "N" },
+  { "sort", 's', 0, G_OPTION_ARG_STRING, &sort_by,
+    "Sort the images by bytes, refs or name (default: bytes)", "KEY" },
+  { "once", '1', 0, G_OPTION_ARG_NONE, &once,
+    "Print the statistics once and exit", NULL },
+  { NULL }
+};
+
+static gint
+compare_clients (gconstpointer a,
+                 gconstpointer b)
+{
+  const PixbufStatsClient *ca = *(const PixbufStatsClient **) a;
+  const PixbufStatsClient *cb = *(const PixbufStatsClient **) b;
+
+  return (gint) cb->n_refs - (gint) ca->n_refs;
+}
+
+static gint
+compare_images (gconstpointer a,
+                gconstpointer b)
+{
+  const PixbufStatsImage *ia = *(const PixbufStatsImage **) a;
+  const PixbufStatsImage *ib = *(const PixbufStatsImage **) b;
+
+  if (sort_by && !strcmp (sort_by, "name"))
+    return strcmp (ia->filename, ib->filename);
+  else if (sort_by && !strcmp (sort_by, "refs"))
+    return (gint) ib->refcnt - (gint) ia->refcnt;
+
+  return ib->bytes < ia->bytes ? -1 : ib->bytes > ia->bytes ? 1 : 0;
+}
+
+static gboolean
+print_stats (const char *reply,
+             gsize       reply_len)
+{
+  const PixbufStatsResponse *stats = (const PixbufStatsResponse *) reply;
+  GPtrArray                 *clients, *images;
+  gsize                      ofs;
+  guint                      i;
+
+  if (reply_len < sizeof (PixbufStatsResponse) ||
+      reply_len < sizeof (PixbufStatsResponse) + stats->n_clients * sizeof (PixbufStatsClient))
+    return FALSE;
+
+  clients = g_ptr_array_new ();
+  images = g_ptr_array_new ();
+
+  ofs = sizeof (PixbufStatsResponse);
+  for (i = 0; i < stats->n_clients; i++, ofs += sizeof (PixbufStatsClient))
+    g_ptr_array_add (clients, (gpointer) (reply + ofs));
+
+  for (i = 0; i < stats->n_images; i++)
+    {
+      const PixbufStatsImage *image = (const PixbufStatsImage *) (reply + ofs);
+
+      if (ofs + sizeof (PixbufStatsImage) > reply_len ||
+	  image->length <= sizeof (PixbufStatsImage) ||
+	  ofs + image->length > reply_len ||
+	  !memchr (image->filename, '\0', image->length - sizeof (PixbufStatsImage)))
+	break;
+
+      g_ptr_array_add (images, (gpointer) image);
+      ofs += image->length;
+    }
+
+  g_ptr_array_sort (clients, compare_clients);
+  g_ptr_array_sort (images, compare_images);
+
+  if (!once)
+    printf ("\033[H\033[2J");
+
+  printf ("sapwood-server: %u clients, %u images, %" G_GUINT64_FORMAT " bytes"
+	  " (%" G_GUINT64_FORMAT " unused)\n",
+	  stats->n_clients, stats->n_images,
+	  stats->pixmap_bytes, stats->retained_bytes);
+  printf ("opens: %u hits, %u misses, %u revived;"
+	  " decoding %.3fs, uploading %.3fs\n\n",
+	  stats->hits, stats->misses, stats->revived,
+	  stats->decode_usec / (double) G_USEC_PER_SEC,
+	  stats->upload_usec / (double) G_USEC_PER_SEC);
+
+  printf ("%8s %8s %8s %8s\n", "PID", "OPENS", "IMAGES", "REFS");
+  for (i = 0; i < clients->len; i++)
+    {
+      const PixbufStatsClient *client = g_ptr_array_index (clients, i);
+
+      printf ("%8u %8u %8u %8u\n",
+	      client->pid, client->n_opens, client->n_images, client->n_refs);
+    }
+
+  printf ("\n%10s %6s %s\n", "BYTES", "REFS", "FILE");
+  for (i = 0; i < images->len && (n_lines <= 0 || i < (guint) n_lines); i++)
+    {
+      const PixbufStatsImage *image = g_ptr_array_index (images, i);
+
+      printf ("%10u %6u %s%s\n", image->bytes, image->refcnt, image->filename,
+	      image->refcnt ? "" : " (unused)");
+    }
+
+  fflush (stdout);
+
+  g_ptr_array_free (clients, TRUE);
+  g_ptr_array_free (images, TRUE);
+
+  return TRUE;
+}
+
+static void
+stats_reply (const char   *reply,
+             gsize         reply_len,
+             const GError *error,
+             gpointer      user_data)
+{
+  if (error)
+    {
+      g_printerr ("%s\n", error->message);
+      g_main_loop_quit (loop);
+      return;
+    }
+
+  if (!print_stats (reply, reply_len))
+    {
+      g_printerr ("invalid reply of %zu bytes\n", reply_len);
+      g_main_loop_quit (loop);
+      return;
+    }
+
+  if (once)
+    g_main_loop_quit (loop);
+}
+
+static gboolean
+stats_request (gpointer user_data)
+{
+  PixbufStatsRequest  req;
+  GError             *error = NULL;
+
+  memset (&req, 0, sizeof (req));
+  req.base.op     = PIXBUF_OP_STATS;
+  req.base.length = sizeof (req);
+
+  if (!sapwood_client_request (&req.base, stats_reply, NULL, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_main_loop_quit (loop);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+
+  context = g_option_context_new ("- show sapwood-server statistics");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  /* for the display name in the socket path */
+  gdk_init (&argc, &argv);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  if (!stats_request (NULL))
+    return 1;
+  if (!once)
+    g_timeout_add_seconds (MAX (interval, 1), stats_request, NULL);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  return 0;
+}
@@ -0,0 +1,243 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <config.h>
+
+#include "shelf-packer.h"
+
+/* shelf heights are rounded up to this, so that images of similar heights
+ * share shelves */
+#define SHELF_ROUND 8
+
+typedef struct
+{
+  gint    x;
+  gint    width;
+} Span;
+
+typedef struct
+{
+  gint    y;
+  gint    height;
+  gint    n_free;               /* pixels of width in free */
+  GList  *free;                 /* Span, sorted by x */
+} Shelf;
+
+struct _ShelfPacker
+{
+  gint    width;
+  gint    height;
+  gint    top;                  /* of the space above all shelves */
+  GList  *shelves;              /* Shelf, sorted by y */
+};
+
+ShelfPacker *
+shelf_packer_new (gint width,
+                  gint height)
+{
+  ShelfPacker *packer = g_new0 (ShelfPacker, 1);
+
+  packer->width  = width;
+  packer->height = height;
+
+  return packer;
+}
+
+static void
+shelf_free (Shelf *shelf)
+{
+  g_list_foreach (shelf->free, (GFunc) g_free, NULL);
+  g_list_free (shelf->free);
+  g_free (shelf);
+}
+
+void
+shelf_packer_free (ShelfPacker *packer)
+{
+  g_list_foreach (packer->shelves, (GFunc) shelf_free, NULL);
+  g_list_free (packer->shelves);
+  g_free (packer);
+}
+
+static gboolean
+shelf_fits (Shelf *shelf,
+            gint   width)
+{
+  GList *l;
+
+  for (l = shelf->free; l; l = l->next)
+    if (((Span *) l->data)->width >= width)
+      return TRUE;
+
+  return FALSE;
+}
+
+/* takes @width pixels from the first free span wide enough */
+static void
+shelf_alloc (Shelf *shelf,
+             gint   width,
+             gint  *x)
+{
+  GList *l;
+
+  for (l = shelf->free; l; l = l->next)
+    {
+      Span *span = l->data;
+
+      if (span->width < width)
+        continue;
+
+      *x = span->x;
+      span->x     += width;
+      span->width -= width;
+      shelf->n_free -= width;
+
+      if (span->width == 0)
+        {
+          g_free (span);
+          shelf->free = g_list_delete_link (shelf->free, l);
+        }
+
+      return;
+    }
+}
+
+gboolean
+shelf_packer_alloc (ShelfPacker *packer,
+                    gint         width,
+                    gint         height,
+                    gint        *x,
+                    gint        *y)
+{
+  Shelf *best = NULL;
+  Shelf *shelf;
+  Span  *span;
+  GList *l;
+
+  if (width <= 0 || height <= 0 ||
+      width > packer->width || height > packer->height)
+    return FALSE;
+
+  /* the lowest shelf the rectangle fits in, a shelf more than twice as
+   * high only if it is completely free */
+  for (l = packer->shelves; l; l = l->next)
+    {
+      shelf = l->data;
+
+      if (shelf->height < height ||
+          (shelf->height > 2 * height && shelf->n_free < packer->width) ||
+          (best && best->height <= shelf->height) ||
+          !shelf_fits (shelf, width))
+        continue;
+
+      best = shelf;
+    }
+
+  /* a new shelf on top */
+  if (!best)
+    {
+      gint shelf_height = MIN ((height + SHELF_ROUND - 1) / SHELF_ROUND * SHELF_ROUND,
+                               packer->height - packer->top);
+
+      if (shelf_height < height)
+        return FALSE;
+
+      best = g_new0 (Shelf, 1);
+      best->y      = packer->top;
+      best->height = shelf_height;
+      best->n_free = packer->width;
+      span = g_new (Span, 1);
+      span->x     = 0;
+      span->width = packer->width;
+      best->free = g_list_prepend (NULL, span);
+
+      packer->shelves = g_list_append (packer->shelves, best);
+      packer->top += shelf_height;
+    }
+
+  shelf_alloc (best, width, x);
+  *y = best->y;
+
+  return TRUE;
+}
+
+/* gives the @width pixels at @x, @y back to the free list of their shelf,
+ * and removes the empty shelves from the top */
+void
+shelf_packer_release (ShelfPacker *packer,
+                      gint         x,
+                      gint         y,
+                      gint         width)
+{
+  Shelf *shelf = NULL;
+  GList *l, *prev = NULL;
+  Span  *span;
+
+  for (l = packer->shelves; l; l = l->next)
+    {
+      shelf = l->data;
+      if (shelf->y == y)
+        break;
+    }
+  g_return_if_fail (l != NULL);
+
+  shelf->n_free += width;
+
+  for (l = shelf->free; l && ((Span *) l->data)->x < x; l = l->next)
+    prev = l;
+
+  /* merge with the neighbours */
+  if (prev && ((Span *) prev->data)->x + ((Span *) prev->data)->width == x)
+    {
+      span = prev->data;
+      span->width += width;
+    }
+  else
+    {
+      span = g_new (Span, 1);
+      span->x     = x;
+      span->width = width;
+      shelf->free = g_list_insert_before (shelf->free, l, span);
+    }
+
+  if (l && span->x + span->width == ((Span *) l->data)->x)
+    {
+      span->width += ((Span *) l->data)->width;
+      g_free (l->data);
+      shelf->free = g_list_delete_link (shelf->free, l);
+    }
+
+  while (packer->shelves)
+    {
+      GList *last = g_list_last (packer->shelves);
+
+      shelf = last->data;
+      if (shelf->n_free != packer->width)
+        break;
+
+      packer->top = shelf->y;
+      shelf_free (shelf);
+      packer->shelves = g_list_delete_link (packer->shelves, last);
+    }
+}
+
+gboolean
+shelf_packer_is_empty (ShelfPacker *packer)
+{
+  return packer->shelves == NULL;
+}
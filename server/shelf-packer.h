@@ -0,0 +1,48 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef SHELF_PACKER_H
+#define SHELF_PACKER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Packs rectangles into a fixed size area in horizontal shelves, the space
+ * released goes to a free list of each shelf and is reused.
+ */
+typedef struct _ShelfPacker ShelfPacker;
+
+ShelfPacker *shelf_packer_new      (gint         width,
+                                    gint         height);
+void         shelf_packer_free     (ShelfPacker *packer);
+
+gboolean     shelf_packer_alloc    (ShelfPacker *packer,
+                                    gint         width,
+                                    gint         height,
+                                    gint        *x,
+                                    gint        *y);
+void         shelf_packer_release  (ShelfPacker *packer,
+                                    gint         x,
+                                    gint         y,
+                                    gint         width);
+gboolean     shelf_packer_is_empty (ShelfPacker *packer);
+
+G_END_DECLS
+
+#endif /* !SHELF_PACKER_H */
@@ -0,0 +1,433 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include "config.h"
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+
+/* The file has a header, the records of the images, their NUL-terminated
+ * file names, their slices and then their pixels, each starting at a
+ * multiple of SNAPSHOT_ALIGN. It is written in the byte order of the
+ * machine; a snapshot of another one does not have the right magic.
+ */
+#define SNAPSHOT_MAGIC   0x53575353 /* "SSWS" on little endian */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ALIGN   16
+
+#define SNAPSHOT_HAS_ALPHA (1 << 0)
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_images;
+  guint32 _pad;
+} SnapshotHeader;
+
+typedef struct
+{
+  gint64  mtime;
+  gint64  file_size;
+  guint64 pixels;               /* offsets into the file */
+  guint32 filename;
+  guint32 width;
+  guint32 height;
+  guint32 stride;
+  guint32 flags;
+  guint32 slices;
+  guint32 n_slices;
+  gchar   digest[44];
+} SnapshotRecord;
+
+struct _Snapshot
+{
+  gint                  ref_count;
+  const guchar         *data;
+  gsize                 size;
+  const SnapshotRecord *records;
+  guint                 n_images;
+  GHashTable           *index;  /* file name -> record index + 1 */
+};
+
+gboolean
+snapshot_file_stat (const char *filename,
+                    gint64     *mtime,
+                    gint64     *file_size)
+{
+  struct stat st;
+
+  if (g_stat (filename, &st) < 0)
+    return FALSE;
+
+  *mtime     = (gint64) st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+  *file_size = st.st_size;
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_record_valid (const Snapshot       *snapshot,
+                       const SnapshotRecord *record)
+{
+  gsize size = snapshot->size;
+
+  if (record->filename >= size ||
+      !memchr (snapshot->data + record->filename, '\0', size - record->filename))
+    return FALSE;
+
+  if (!memchr (record->digest, '\0', sizeof (record->digest)))
+    return FALSE;
+
+  if (record->slices % 4 || record->slices > size ||
+      record->n_slices > (size - record->slices) / sizeof (SnapshotSlice))
+    return FALSE;
+
+  if (record->width == 0 || record->height == 0 ||
+      record->width > G_MAXINT16 || record->height > G_MAXINT16 ||
+      record->stride < record->width * 4 || record->stride % 4 ||
+      record->pixels % SNAPSHOT_ALIGN || record->pixels > size ||
+      (guint64) record->stride * record->height > size - record->pixels)
+    return FALSE;
+
+  return TRUE;
+}
+
+Snapshot *
+snapshot_open (const char  *filename,
+               GError     **err)
+{
+  const SnapshotHeader *header;
+  Snapshot             *snapshot;
+  struct stat           st;
+  gpointer              data;
+  int                   fd;
+  guint                 i;
+
+  fd = g_open (filename, O_RDONLY, 0);
+  if (fd < 0 || fstat (fd, &st) < 0)
+    {
+      int errsv = errno;
+
+      g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "%s: %s", filename, g_strerror (errsv));
+      if (fd >= 0)
+        close (fd);
+      return NULL;
+    }
+
+  if (st.st_size < (off_t) sizeof (SnapshotHeader))
+    {
+      g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s: not a sapwood snapshot", filename);
+      close (fd);
+      return NULL;
+    }
+
+  /* the mapping stays valid after the close */
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      int errsv = errno;
+
+      g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "%s: %s", filename, g_strerror (errsv));
+      return NULL;
+    }
+
+  snapshot = g_new0 (Snapshot, 1);
+  snapshot->ref_count = 1;
+  snapshot->data      = data;
+  snapshot->size      = st.st_size;
+  snapshot->index     = g_hash_table_new (g_str_hash, g_str_equal);
+
+  header = data;
+  if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION)
+    {
+      g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "%s: not a sapwood snapshot of this version", filename);
+      snapshot_unref (snapshot);
+      return NULL;
+    }
+
+  if (header->n_images > (snapshot->size - sizeof (SnapshotHeader)) / sizeof (SnapshotRecord))
+    goto corrupt;
+
+  snapshot->records  = (const SnapshotRecord *) (header + 1);
+  snapshot->n_images = header->n_images;
+
+  for (i = 0; i < snapshot->n_images; i++)
+    {
+      const SnapshotRecord *record = &snapshot->records[i];
+
+      if (!snapshot_record_valid (snapshot, record))
+        goto corrupt;
+
+      g_hash_table_insert (snapshot->index,
+                           (gpointer) (snapshot->data + record->filename),
+                           GUINT_TO_POINTER (i + 1));
+    }
+
+  return snapshot;
+
+corrupt:
+  g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+               "%s: corrupt snapshot", filename);
+  snapshot_unref (snapshot);
+  return NULL;
+}
+
+Snapshot *
+snapshot_ref (Snapshot *snapshot)
+{
+  snapshot->ref_count++;
+
+  return snapshot;
+}
+
+void
+snapshot_unref (Snapshot *snapshot)
+{
+  if (--snapshot->ref_count)
+    return;
+
+  g_hash_table_destroy (snapshot->index);
+  munmap ((gpointer) snapshot->data, snapshot->size);
+  g_free (snapshot);
+}
+
+guint
+snapshot_get_n_images (Snapshot *snapshot)
+{
+  return snapshot->n_images;
+}
+
+void
+snapshot_get_image (Snapshot      *snapshot,
+                    guint          index,
+                    SnapshotImage *image)
+{
+  const SnapshotRecord *record = &snapshot->records[index];
+
+  image->filename  = (const char *) snapshot->data + record->filename;
+  image->mtime     = record->mtime;
+  image->file_size = record->file_size;
+  image->width     = record->width;
+  image->height    = record->height;
+  image->stride    = record->stride;
+  image->has_alpha = (record->flags & SNAPSHOT_HAS_ALPHA) != 0;
+  image->pixels    = snapshot->data + record->pixels;
+  image->digest    = record->digest;
+  image->slices    = (const SnapshotSlice *) (snapshot->data + record->slices);
+  image->n_slices  = record->n_slices;
+}
+
+const SnapshotSlice *
+snapshot_image_find_slice (const SnapshotImage *image,
+                           guint                border_left,
+                           guint                border_right,
+                           guint                border_top,
+                           guint                border_bottom)
+{
+  guint i;
+
+  for (i = 0; i < image->n_slices; i++)
+    {
+      const SnapshotSlice *slice = &image->slices[i];
+
+      if (slice->border_left == border_left &&
+          slice->border_right == border_right &&
+          slice->border_top == border_top &&
+          slice->border_bottom == border_bottom)
+        return slice;
+    }
+
+  return NULL;
+}
+
+gboolean
+snapshot_lookup (Snapshot      *snapshot,
+                 const char    *filename,
+                 SnapshotImage *image)
+{
+  guint  index;
+  gint64 mtime, file_size;
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (snapshot->index, filename));
+  if (!index)
+    return FALSE;
+
+  snapshot_get_image (snapshot, index - 1, image);
+
+  return snapshot_file_stat (filename, &mtime, &file_size) &&
+         mtime == image->mtime && file_size == image->file_size;
+}
+
+static gboolean
+write_all (FILE          *f,
+           gconstpointer  data,
+           gsize          size)
+{
+  return size == 0 || fwrite (data, size, 1, f) == 1;
+}
+
+gboolean
+snapshot_write (const char          *filename,
+                const SnapshotImage *images,
+                guint                n_images,
+                GError             **err)
+{
+  static const guchar  zeros[SNAPSHOT_ALIGN];
+  SnapshotHeader       header;
+  SnapshotRecord      *records;
+  gchar               *tmp_filename;
+  guint64              ofs;
+  FILE                *f;
+  int                  fd;
+  guint                i;
+  gboolean             ok;
+
+  records = g_new0 (SnapshotRecord, n_images);
+
+  ofs = sizeof (SnapshotHeader) + n_images * sizeof (SnapshotRecord);
+  for (i = 0; i < n_images; i++)
+    {
+      records[i].filename = ofs;
+      ofs += strlen (images[i].filename) + 1;
+    }
+
+  ofs = (ofs + 3) & ~(guint64) 3;
+  for (i = 0; i < n_images; i++)
+    {
+      records[i].slices   = ofs;
+      records[i].n_slices = images[i].n_slices;
+      ofs += images[i].n_slices * sizeof (SnapshotSlice);
+    }
+
+  for (i = 0; i < n_images; i++)
+    {
+      const SnapshotImage *image = &images[i];
+      SnapshotRecord      *record = &records[i];
+
+      ofs = (ofs + SNAPSHOT_ALIGN - 1) & ~(guint64) (SNAPSHOT_ALIGN - 1);
+
+      record->mtime     = image->mtime;
+      record->file_size = image->file_size;
+      record->pixels    = ofs;
+      record->width     = image->width;
+      record->height    = image->height;
+      record->stride    = image->width * 4;
+      record->flags     = image->has_alpha ? SNAPSHOT_HAS_ALPHA : 0;
+      if (image->digest)
+        g_strlcpy (record->digest, image->digest, sizeof (record->digest));
+
+      ofs += (guint64) record->stride * record->height;
+    }
+
+  /* for the ftell() below */
+  if (ofs > G_MAXLONG)
+    {
+      g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_FBIG,
+                   "%s: snapshot too large", filename);
+      g_free (records);
+      return FALSE;
+    }
+
+  memset (&header, 0, sizeof (header));
+  header.magic    = SNAPSHOT_MAGIC;
+  header.version  = SNAPSHOT_VERSION;
+  header.n_images = n_images;
+
+  /* written next to the old one and renamed over it, so that a running
+   * server keeps a consistent mapping of the old one */
+  tmp_filename = g_strconcat (filename, ".XXXXXX", NULL);
+  fd = g_mkstemp (tmp_filename);
+  if (fd < 0 || !(f = fdopen (fd, "wb")))
+    {
+      int errsv = errno;
+
+      g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "%s: %s", tmp_filename, g_strerror (errsv));
+      if (fd >= 0)
+        {
+          close (fd);
+          g_unlink (tmp_filename);
+        }
+      g_free (tmp_filename);
+      g_free (records);
+      return FALSE;
+    }
+
+  ok = write_all (f, &header, sizeof (header)) &&
+       write_all (f, records, n_images * sizeof (SnapshotRecord));
+
+  for (i = 0; ok && i < n_images; i++)
+    ok = write_all (f, images[i].filename, strlen (images[i].filename) + 1);
+
+  for (i = 0; ok && i < n_images; i++)
+    {
+      long pos = ftell (f);
+
+      ok = pos >= 0 &&
+           write_all (f, zeros, records[i].slices - pos) &&
+           write_all (f, images[i].slices, images[i].n_slices * sizeof (SnapshotSlice));
+    }
+
+  for (i = 0; ok && i < n_images; i++)
+    {
+      const SnapshotImage *image = &images[i];
+      long                 pos = ftell (f);
+      gint                 y;
+
+      ok = pos >= 0 &&
+           write_all (f, zeros, records[i].pixels - pos);
+
+      for (y = 0; ok && y < image->height; y++)
+        ok = write_all (f, image->pixels + y * image->stride, records[i].stride);
+    }
+
+  if (fclose (f) != 0)
+    ok = FALSE;
+
+  if (ok && g_rename (tmp_filename, filename) < 0)
+    ok = FALSE;
+
+  if (!ok)
+    {
+      int errsv = errno;
+
+      g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "%s: %s", filename, g_strerror (errsv));
+      g_unlink (tmp_filename);
+    }
+
+  g_free (tmp_filename);
+  g_free (records);
+
+  return ok;
+}
@@ -0,0 +1,100 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A file of decoded images, mapped read-only, so that a restarted server
+ * does not have to decode them again. The images are keyed by the path,
+ * modification time and size of the file they were decoded from. Theme
+ * packs are snapshots made ahead of time by sapwood-pack.
+ */
+typedef struct _Snapshot Snapshot;
+
+/* the parts of an image sliced with a set of borders, as sapwood-pack finds
+ * them from the gtkrc; bit i * 3 + j is for part [i][j] */
+typedef struct
+{
+  guint16 border_left;
+  guint16 border_right;
+  guint16 border_top;
+  guint16 border_bottom;
+  guint16 transparent;          /* fully transparent */
+  guint16 mixed;                /* partially transparent, needs a mask */
+  guint16 solid;                /* opaque and of a single color */
+  guint16 _pad;
+  guint32 color[3][3];          /* premultiplied 0xRRGGBB of the solid parts */
+} SnapshotSlice;
+
+/* an image in a snapshot, or to be written into one */
+typedef struct
+{
+  const char          *filename;
+  gint64               mtime;   /* of the file, in microseconds */
+  gint64               file_size;
+  gint                 width;
+  gint                 height;
+  gint                 stride;  /* a multiple of 4 */
+  gboolean             has_alpha;
+  const guchar        *pixels;  /* premultiplied ARGB32, as in cairo */
+  const char          *digest;  /* of the decoded pixels */
+  const SnapshotSlice *slices;  /* sapwood-pack only */
+  guint                n_slices;
+} SnapshotImage;
+
+/* the mtime and size snapshot_lookup() compares against */
+gboolean  snapshot_file_stat (const char    *filename,
+                              gint64        *mtime,
+                              gint64        *file_size);
+
+Snapshot *snapshot_open      (const char    *filename,
+                              GError       **err);
+Snapshot *snapshot_ref       (Snapshot      *snapshot);
+void      snapshot_unref     (Snapshot      *snapshot);
+
+/* finds the image decoded from @filename, unless the file was changed
+ * since; the image is valid as long as @snapshot is */
+gboolean  snapshot_lookup    (Snapshot      *snapshot,
+                              const char    *filename,
+                              SnapshotImage *image);
+
+const SnapshotSlice *
+          snapshot_image_find_slice (const SnapshotImage *image,
+                                     guint                border_left,
+                                     guint                border_right,
+                                     guint                border_top,
+                                     guint                border_bottom);
+
+guint     snapshot_get_n_images (Snapshot      *snapshot);
+void      snapshot_get_image    (Snapshot      *snapshot,
+                                 guint          index,
+                                 SnapshotImage *image);
+
+/* writes the @n_images @images to a new snapshot replacing @filename */
+gboolean  snapshot_write     (const char          *filename,
+                              const SnapshotImage *images,
+                              guint                n_images,
+                              GError             **err);
+
+G_END_DECLS
+
+#endif /* !SNAPSHOT_H */
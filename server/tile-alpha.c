@@ -0,0 +1,193 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <config.h>
+
+#include "tile-alpha.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* the bit of an ARGB32 pixel telling whether its alpha is >= 128 */
+#define ALPHA_BIT 0x80000000
+
+/* ANDs and ORs @n pixels into @and_bits and @or_bits, so the alpha bit of
+ * the former is set if all pixels are opaque and the one of the latter if
+ * any is */
+static void
+scan_row (const guint32 *p,
+          gint           n,
+          guint32       *and_bits,
+          guint32       *or_bits)
+{
+  guint32 a = *and_bits;
+  guint32 o = *or_bits;
+  gint    i = 0;
+
+#if defined(__SSE2__)
+  if (n >= 4)
+    {
+      __m128i va = _mm_set1_epi32 (-1);
+      __m128i vo = _mm_setzero_si128 ();
+      guint32 ra[4], ro[4];
+
+      for (; i + 4 <= n; i += 4)
+        {
+          __m128i v = _mm_loadu_si128 ((const __m128i *) (p + i));
+
+          va = _mm_and_si128 (va, v);
+          vo = _mm_or_si128 (vo, v);
+        }
+
+      _mm_storeu_si128 ((__m128i *) ra, va);
+      _mm_storeu_si128 ((__m128i *) ro, vo);
+      a &= ra[0] & ra[1] & ra[2] & ra[3];
+      o |= ro[0] | ro[1] | ro[2] | ro[3];
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+  if (n >= 4)
+    {
+      uint32x4_t va = vdupq_n_u32 (0xffffffff);
+      uint32x4_t vo = vdupq_n_u32 (0);
+
+      for (; i + 4 <= n; i += 4)
+        {
+          uint32x4_t v = vld1q_u32 (p + i);
+
+          va = vandq_u32 (va, v);
+          vo = vorrq_u32 (vo, v);
+        }
+
+      a &= vgetq_lane_u32 (va, 0) & vgetq_lane_u32 (va, 1) &
+           vgetq_lane_u32 (va, 2) & vgetq_lane_u32 (va, 3);
+      o |= vgetq_lane_u32 (vo, 0) | vgetq_lane_u32 (vo, 1) |
+           vgetq_lane_u32 (vo, 2) | vgetq_lane_u32 (vo, 3);
+    }
+#endif
+
+  for (; i < n; i++)
+    {
+      a &= p[i];
+      o |= p[i];
+    }
+
+  *and_bits = a;
+  *or_bits  = o;
+}
+
+TileAlpha
+tile_alpha_classify (const guchar *pixels,
+                     gint          stride,
+                     gint          x,
+                     gint          y,
+                     gint          width,
+                     gint          height)
+{
+  guint32 and_bits = 0xffffffff;
+  guint32 or_bits  = 0;
+  gint    row;
+
+  for (row = y; row < y + height; row++)
+    {
+      scan_row ((const guint32 *) (pixels + row * stride) + x, width,
+                &and_bits, &or_bits);
+
+      /* no need to look any further */
+      if (!(and_bits & ALPHA_BIT) && (or_bits & ALPHA_BIT))
+        return TILE_ALPHA_MIXED;
+    }
+
+  if (and_bits & ALPHA_BIT)
+    return TILE_ALPHA_OPAQUE;
+  if (!(or_bits & ALPHA_BIT))
+    return TILE_ALPHA_TRANSPARENT;
+
+  return TILE_ALPHA_MIXED;
+}
+
+gboolean
+tile_alpha_is_solid (const guchar *pixels,
+                     gint          stride,
+                     gint          x,
+                     gint          y,
+                     gint          width,
+                     gint          height,
+                     guint32      *color)
+{
+  guint32 first = ((const guint32 *) (pixels + y * stride))[x] & 0xffffff;
+  gint    row, i;
+
+  /* mismatches are usually found in the first few pixels, so there is no
+   * point in vectorizing this */
+  for (row = y; row < y + height; row++)
+    {
+      const guint32 *p = (const guint32 *) (pixels + row * stride) + x;
+
+      for (i = 0; i < width; i++)
+        if ((p[i] & 0xffffff) != first)
+          return FALSE;
+    }
+
+  *color = first;
+  return TRUE;
+}
+
+gboolean
+tile_alpha_rows_equal (const guchar *pixels,
+                       gint          stride,
+                       gint          x,
+                       gint          y,
+                       gint          width,
+                       gint          height)
+{
+  const guchar *first = pixels + y * stride + x * 4;
+  gint          row;
+
+  for (row = y + 1; row < y + height; row++)
+    if (memcmp (pixels + row * stride + x * 4, first, width * 4))
+      return FALSE;
+
+  return TRUE;
+}
+
+gboolean
+tile_alpha_columns_equal (const guchar *pixels,
+                          gint          stride,
+                          gint          x,
+                          gint          y,
+                          gint          width,
+                          gint          height)
+{
+  gint row, i;
+
+  for (row = y; row < y + height; row++)
+    {
+      const guint32 *p = (const guint32 *) (pixels + row * stride) + x;
+
+      for (i = 1; i < width; i++)
+        if (p[i] != p[0])
+          return FALSE;
+    }
+
+  return TRUE;
+}
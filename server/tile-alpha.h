@@ -0,0 +1,75 @@
+/* This file is part of the GTK+ Sapwood Engine
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef TILE_ALPHA_H
+#define TILE_ALPHA_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  TILE_ALPHA_OPAQUE,            /* the mask would be all ones */
+  TILE_ALPHA_TRANSPARENT,       /* the mask would be all zeros */
+  TILE_ALPHA_MIXED
+} TileAlpha;
+
+/* Classifies the @width x @height rectangle of ARGB32 @pixels (as in a
+ * cairo image surface, @stride in bytes) by the alpha threshold of 128 used
+ * for the masks.
+ */
+TileAlpha tile_alpha_classify (const guchar *pixels,
+                               gint          stride,
+                               gint          x,
+                               gint          y,
+                               gint          width,
+                               gint          height);
+
+/* Returns %TRUE if all pixels of the rectangle have the same color, in
+ * @color as 0xRRGGBB (premultiplied, so as painted over black), ignoring
+ * the alpha; only meaningful for TILE_ALPHA_OPAQUE tiles.
+ */
+gboolean  tile_alpha_is_solid (const guchar *pixels,
+                               gint          stride,
+                               gint          x,
+                               gint          y,
+                               gint          width,
+                               gint          height,
+                               guint32      *color);
+
+/* Whether all rows of the rectangle are the same, so that it tiles like a
+ * single row of it (vertical gradients and the like). */
+gboolean  tile_alpha_rows_equal    (const guchar *pixels,
+                                    gint          stride,
+                                    gint          x,
+                                    gint          y,
+                                    gint          width,
+                                    gint          height);
+
+/* Likewise for the columns, i.e. every row is of a single color. */
+gboolean  tile_alpha_columns_equal (const guchar *pixels,
+                                    gint          stride,
+                                    gint          x,
+                                    gint          y,
+                                    gint          width,
+                                    gint          height);
+
+G_END_DECLS
+
+#endif /* !TILE_ALPHA_H */
@@ -0,0 +1,121 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+#include "image-slice.h"
+#include "tile-alpha.h"
+
+#define SIZE 19                 /* not a multiple of the vector width */
+
+static guint32 pixels[SIZE * SIZE];
+
+static TileAlpha
+classify (gint x, gint y, gint width, gint height)
+{
+  return tile_alpha_classify ((const guchar *) pixels, SIZE * sizeof (guint32),
+                              x, y, width, height);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  guint32 color = 0;
+  gint    i;
+
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0x80402010;
+
+  g_assert (classify (0, 0, SIZE, SIZE) == TILE_ALPHA_OPAQUE);
+
+  /* a single pixel in the last, scalar, column of a row */
+  pixels[7 * SIZE + SIZE - 1] = 0x7f402010;
+  g_assert (classify (0, 0, SIZE, SIZE) == TILE_ALPHA_MIXED);
+  g_assert (classify (0, 0, SIZE - 1, SIZE) == TILE_ALPHA_OPAQUE);
+  g_assert (classify (SIZE - 1, 7, 1, 1) == TILE_ALPHA_TRANSPARENT);
+
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0x7fffffff;
+
+  g_assert (classify (0, 0, SIZE, SIZE) == TILE_ALPHA_TRANSPARENT);
+
+  /* and one in the middle of a vector */
+  pixels[11 * SIZE + 5] = 0xff000000;
+  g_assert (classify (0, 0, SIZE, SIZE) == TILE_ALPHA_MIXED);
+  g_assert (classify (3, 10, 8, 3) == TILE_ALPHA_MIXED);
+  g_assert (classify (6, 0, SIZE - 6, SIZE) == TILE_ALPHA_TRANSPARENT);
+
+  /* solid colors ignore the alpha */
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0xff804020;
+  pixels[3 * SIZE + 4] = 0x80804020;
+
+  g_assert (tile_alpha_is_solid ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                 0, 0, SIZE, SIZE, &color));
+  g_assert (color == 0x804020);
+
+  pixels[SIZE * SIZE - 1] = 0xff804021;
+  g_assert (!tile_alpha_is_solid ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                  0, 0, SIZE, SIZE, &color));
+  g_assert (tile_alpha_is_solid ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                 0, 0, SIZE - 1, SIZE, &color));
+
+  /* a vertical gradient, every row is the same */
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0xff000000 | (i / SIZE) << 16 | (i % SIZE);
+
+  g_assert (!tile_alpha_rows_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                    0, 0, SIZE, SIZE));
+  g_assert (!tile_alpha_columns_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                       0, 0, SIZE, SIZE));
+  g_assert (tile_alpha_rows_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                   2, 3, 4, 1));
+  g_assert (tile_alpha_columns_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                      2, 3, 1, 5));
+
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0xff000000 | (i % SIZE);
+  g_assert (tile_alpha_rows_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                   0, 0, SIZE, SIZE));
+
+  for (i = 0; i < SIZE * SIZE; i++)
+    pixels[i] = 0xff000000 | (i / SIZE);
+  g_assert (tile_alpha_columns_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                      0, 0, SIZE, SIZE));
+  pixels[5 * SIZE + SIZE - 1] = 0;
+  g_assert (!tile_alpha_columns_equal ((const guchar *) pixels, SIZE * sizeof (guint32),
+                                       0, 0, SIZE, SIZE));
+
+  /* borders that do not fit are clamped to the image */
+  {
+    gint bounds_x[4], bounds_y[4];
+
+    image_slice_bounds (SIZE, SIZE, 30, 4, 2, 40, bounds_x, bounds_y);
+    g_assert (bounds_x[1] == SIZE && bounds_x[2] == SIZE - 4);
+    g_assert (bounds_y[1] == 2 && bounds_y[2] == 0);
+
+    for (i = 0; i < 3; i++)
+      {
+        g_assert (bounds_x[i] >= 0 && bounds_x[i + 1] <= SIZE);
+        g_assert (bounds_y[i] >= 0 && bounds_y[i + 1] <= SIZE);
+      }
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+#include <string.h>
+
+#include "pixel-convert.h"
+
+#define WIDTH 21                /* not a multiple of the vector width */
+
+/* the 4x4 dither of pixel_convert_row_565(), one pixel at a time */
+static guint16
+convert_565 (guint32 p,
+             gint    x,
+             gint    y)
+{
+  static const guint8 dither[4][4] =
+  {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+  };
+  guint d = dither[y & 3][x & 3];
+  guint r = MIN (((p >> 16) & 0xff) + (d >> 1), 0xff);
+  guint g = MIN (((p >> 8) & 0xff) + (d >> 2), 0xff);
+  guint b = MIN ((p & 0xff) + (d >> 1), 0xff);
+
+  return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  guint32 src[WIDTH], dst[WIDTH];
+  guint16 dst16[WIDTH];
+  guint8  mask[(WIDTH + 7) / 8];
+  gint    i, y, n;
+
+  /* only the alpha bits of pixels 0, 9 and 20 are set */
+  for (i = 0; i < WIDTH; i++)
+    src[i] = 0x7f000000 | i << 16 | i << 8 | i;
+  src[0]  |= 0x80000000;
+  src[9]  |= 0x80000000;
+  src[20] |= 0x80000000;
+
+  memset (mask, 0xaa, sizeof (mask));
+  pixel_convert_row (src, dst, mask, WIDTH);
+
+  for (i = 0; i < WIDTH; i++)
+    g_assert (dst[i] == (src[i] & 0xffffff));
+
+  g_assert (mask[0] == 0x80);
+  g_assert (mask[1] == 0x40);
+  g_assert (mask[2] == 0x08);
+
+  /* either output may be left out */
+  memset (dst, 0, sizeof (dst));
+  pixel_convert_row (src, dst, NULL, WIDTH);
+  g_assert (dst[WIDTH - 1] == 0x141414);
+
+  src[15] = 0xff000000;
+  pixel_convert_row (src, NULL, mask, WIDTH);
+  g_assert (mask[1] == 0x41);
+
+  /* the mask is the same for 16 bit pixels */
+  memset (mask, 0, sizeof (mask));
+  pixel_convert_row_565 (src, dst16, mask, WIDTH, 0);
+  g_assert (mask[0] == 0x80 && mask[1] == 0x41 && mask[2] == 0x08);
+
+  /* white stays white */
+  for (i = 0; i < WIDTH; i++)
+    src[i] = 0xffffffff;
+  pixel_convert_row_565 (src, dst16, NULL, WIDTH, 0);
+  for (i = 0; i < WIDTH; i++)
+    g_assert (dst16[i] == 0xffff);
+
+  /* half a step of red and blue, and a quarter of green, is dithered to
+   * half and a quarter of the pixels of a 4x4 block */
+  for (i = 0; i < WIDTH; i++)
+    src[i] = 0xff040104;
+  for (y = 0, n = 0; y < 4; y++)
+    {
+      pixel_convert_row_565 (src, dst16, NULL, 4, y);
+      for (i = 0; i < 4; i++)
+        {
+          g_assert ((dst16[i] >> 11) == (dst16[i] & 0x1f));
+          n += dst16[i] >> 11;
+          n += ((dst16[i] >> 5) & 0x3f) << 4;
+        }
+    }
+  g_assert ((n & 0xf) == 8);
+  g_assert ((n >> 4) == 4);
+
+  /* every pixel and mask bit of a full row, vectors and tail alike */
+  for (y = 0; y < 4; y++)
+    {
+      for (i = 0; i < WIDTH; i++)
+        src[i] = g_random_int ();
+      src[1] = 0xfffefdfc;
+
+      memset (mask, 0, sizeof (mask));
+      pixel_convert_row_565 (src, dst16, mask, WIDTH, y);
+      for (i = 0; i < WIDTH; i++)
+        {
+          g_assert (dst16[i] == convert_565 (src[i], i, y));
+          g_assert (!(mask[i / 8] & (0x80 >> (i % 8))) == !(src[i] & 0x80000000));
+        }
+    }
+
+  return 0;
+}
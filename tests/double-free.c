@@ -26,6 +26,7 @@
 #include <config.h>
 
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -37,70 +38,11 @@
 #endif
 #include "sapwood-pixmap-priv.h"
 #include "sapwood-proto.h"
+#include "test-open.h"
 
 #define SAPWOOD_SERVER "sapwood-server"
 
-/* FIXME: refactor this out into a libproto-client.la library for the engine
- * and the test cases */
-static gboolean
-pixbuf_proto_request (const char *req,
-                      ssize_t     reqlen,
-                      char       *rep,
-                      ssize_t     replen,
-                      GError    **err)
-{
-  static int fd = -1;
-  ssize_t    n;
-
-  if (fd == -1)
-    {
-      fd = sapwood_client_get_socket (err);
-      if (fd == -1)
-	return FALSE;
-    }
-
-  n = write (fd, req, reqlen);
-  if (n < 0)
-    {
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-		   "write: %s", g_strerror (errno));
-      return FALSE;
-    }
-  else if (n != reqlen)
-    {
-      /* FIXME */
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-                   "wrote %zd of %zd bytes", n, reqlen);
-      return FALSE;
-    }
-
-  if (!rep)
-    return TRUE;
-
-  n = read (fd, rep, replen);
-  if (n < 0)
-    {
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-		   "read: %s", g_strerror (errno));
-      return FALSE;
-    }
-  else if (n != replen)
-    {
-      /* FIXME */
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-                   "read %zd, expected %zd bytes", n, replen);
-      return FALSE;
-    }
-  else if (n != replen)
-    {
-      /* FIXME */
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-                   "read %zd, expected %zd bytes", n, replen);
-      return FALSE;
-    }
-
-  return TRUE;
-}
+static gboolean failed = FALSE;
 
 SapwoodPixmap *
 sapwood_pixmap_get_for_file (const char *filename,
@@ -111,29 +53,10 @@ sapwood_pixmap_get_for_file (const char *filename,
                              GError    **err)
 {
   SapwoodPixmap     *self;
-  char               buf[ sizeof(PixbufOpenRequest) + PATH_MAX + 1 ] = {0};
-  PixbufOpenRequest *req = (PixbufOpenRequest *) buf;
   PixbufOpenResponse rep;
-  int                flen;
-
-  /* marshal request */
-  flen = g_strlcpy (req->filename, filename, PATH_MAX);
-  if (flen > PATH_MAX)
-    {
-      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
-		   "%s: filename too long", filename);
-      return NULL;
-    }
-
-  req->base.op       = PIXBUF_OP_OPEN;
-  req->base.length   = sizeof(*req) + flen + 1;
-  req->border_left   = border_left;
-  req->border_right  = border_right;
-  req->border_top    = border_top;
-  req->border_bottom = border_bottom;
 
-  if (!pixbuf_proto_request ((char*)req,  req->base.length,
-			     (char*)&rep, sizeof(rep), err))
+  if (!test_open_image (filename, border_left, border_right, border_top,
+                        border_bottom, &rep, err))
     return NULL;
 
   /* unmarshal response */
@@ -145,23 +68,6 @@ sapwood_pixmap_get_for_file (const char *filename,
   return self;
 }
 
-static void
-pixbuf_proto_unref_pixmap (guint32 id)
-{
-  PixbufCloseRequest  req;
-  GError             *err = NULL;
-
-  req.base.op     = PIXBUF_OP_CLOSE;
-  req.base.length = sizeof(PixbufCloseRequest);
-  req.id          = id;
-  if (!pixbuf_proto_request ((char*)&req, req.base.length, NULL, 0, &err))
-    {
-      g_warning ("close(0x%x): %s", id, err->message);
-      g_error_free (err);
-      return;
-    }
-}
-
 static gboolean
 false_func (void)
 {
@@ -183,7 +89,7 @@ false_func (void)
     }
   else
     {
-      pixbuf_proto_unref_pixmap (pixmap->id);
+      test_close_image (pixmap->id);
       g_free (pixmap);
     }
 
@@ -192,6 +98,80 @@ false_func (void)
   return FALSE;
 }
 
+/* checks that the X server knows every pixmap and mask of the reply */
+static gboolean
+pixmaps_alive (const PixbufOpenResponse *rep)
+{
+  gboolean alive = TRUE;
+  gint     i, j;
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+        guint32 xids[2] = { rep->pixmap[i][j], rep->pixmask[i][j] };
+        gint    k;
+
+        for (k = 0; k < 2; k++)
+          {
+            GdkPixmap *pixmap;
+
+            if (!xids[k])
+              continue;
+
+            gdk_error_trap_push ();
+            pixmap = gdk_pixmap_foreign_new (xids[k]);
+            if (pixmap)
+              g_object_unref (pixmap);
+            if (gdk_error_trap_pop () || !pixmap)
+              {
+                g_warning ("part %d,%d: 0x%x is not a pixmap", i, j, xids[k]);
+                alive = FALSE;
+              }
+          }
+      }
+
+  return alive;
+}
+
+/* opens and closes the same image twice; with --retain-time=0 the server
+ * frees it when it is closed, and must not share the freed one with the
+ * second open */
+static gboolean
+reopen_func (void)
+{
+  GFile* top_srcdir = g_file_new_for_commandline_arg (g_getenv ("top_srcdir"));
+  GFile* image = g_file_resolve_relative_path (top_srcdir, "demos/images/gradient.png");
+  gchar* path;
+  gint i;
+
+  path = g_file_get_path (image);
+
+  for (i = 0; i < 2; i++)
+    {
+      PixbufOpenResponse rep;
+      GError* error = NULL;
+
+      if (!test_open_image (path, 4, 4, 4, 4, &rep, &error))
+        {
+          g_warning ("Error creating pixmap: %s",
+                     error->message);
+          g_clear_error (&error);
+          failed = TRUE;
+          break;
+        }
+
+      if (!pixmaps_alive (&rep))
+        failed = TRUE;
+
+      test_close_image (rep.id);
+    }
+
+  g_free (path);
+  g_object_unref (image);
+  g_object_unref (top_srcdir);
+  return FALSE;
+}
+
 int
 main (int   argc,
       char**argv)
@@ -215,12 +195,13 @@ main (int   argc,
     }
 
   loop = g_main_loop_new (NULL, FALSE);
-  g_timeout_add_full (G_PRIORITY_LOW, 100,
-                      (GSourceFunc)false_func, loop,
+  g_timeout_add (100, (GSourceFunc)false_func, NULL);
+  g_timeout_add_full (G_PRIORITY_LOW, 200,
+                      (GSourceFunc)reopen_func, loop,
                       (GDestroyNotify)g_main_loop_quit);
   g_main_loop_run (loop);
   g_main_loop_unref (loop);
   close (fd);
-  return 0;
+  return failed ? 1 : 0;
 }
 
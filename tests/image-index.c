@@ -0,0 +1,190 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+#include <string.h>
+
+#include "theme-image-index.h"
+
+static const gchar *details[] =
+{
+  NULL, "button", "buttondefault", "cell_even_start", "cell_odd_start",
+  "cell_even_middle", "*_start", "*start", "*_middle", "*", "entry"
+};
+
+/* the linear scan the index replaces */
+static ThemeImage *
+match_linear (GList          *img_list,
+              ThemeMatchData *match_data)
+{
+  for (; img_list; img_list = img_list->next)
+    {
+      ThemeImage *image = img_list->data;
+      guint       flags;
+
+      if (match_data->function != image->match_data.function)
+        continue;
+
+      flags = match_data->flags & image->match_data.flags;
+      if (flags != image->match_data.flags)
+        continue;
+      if ((flags & THEME_MATCH_STATE) &&
+          match_data->state != image->match_data.state)
+        continue;
+      if ((flags & THEME_MATCH_POSITION) &&
+          match_data->position != image->match_data.position)
+        continue;
+      if ((flags & THEME_MATCH_SHADOW) &&
+          match_data->shadow != image->match_data.shadow)
+        continue;
+      if ((flags & THEME_MATCH_ARROW_DIRECTION) &&
+          match_data->arrow_direction != image->match_data.arrow_direction)
+        continue;
+      if ((flags & THEME_MATCH_ORIENTATION) &&
+          match_data->orientation != image->match_data.orientation)
+        continue;
+      if ((flags & THEME_MATCH_GAP_SIDE) &&
+          match_data->gap_side != image->match_data.gap_side)
+        continue;
+
+      if (image->match_data.detail)
+        {
+          if (!match_data->detail)
+            continue;
+          else if (image->match_data.detail[0] == '*')
+            {
+              if (!g_str_has_suffix (match_data->detail, image->match_data.detail + 1))
+                continue;
+            }
+          else if (strcmp (match_data->detail, image->match_data.detail) != 0)
+            continue;
+        }
+
+      return image;
+    }
+
+  return NULL;
+}
+
+static void
+random_match_data (GRand          *rand,
+                   ThemeMatchData *match_data,
+                   gboolean        intern)
+{
+  const gchar *detail;
+
+  memset (match_data, 0, sizeof (*match_data));
+  match_data->function = g_rand_int_range (rand, TOKEN_D_HLINE, TOKEN_D_HLINE + 4);
+  match_data->state = g_rand_int_range (rand, 0, 5);
+  match_data->shadow = g_rand_int_range (rand, 0, 3);
+  match_data->orientation = g_rand_int_range (rand, 0, 2);
+  /* a few of the combinations, so that they match now and then */
+  match_data->position = g_rand_int_range (rand, 0, 2) ? THEME_POS_LEFT | THEME_POS_TOP
+                                                       : THEME_POS_RIGHT;
+  match_data->arrow_direction = g_rand_int_range (rand, 0, 2) ? GTK_ARROW_UP : GTK_ARROW_RIGHT;
+  match_data->gap_side = g_rand_int_range (rand, 0, 2) ? GTK_POS_TOP : GTK_POS_BOTTOM;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_STATE;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_SHADOW;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_ORIENTATION;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_POSITION;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_ARROW_DIRECTION;
+  if (g_rand_boolean (rand))
+    match_data->flags |= THEME_MATCH_GAP_SIDE;
+
+  detail = details[g_rand_int_range (rand, 0, G_N_ELEMENTS (details))];
+  if (detail && detail[0] == '*')
+    detail = "cell_odd_middle";
+  match_data->detail = intern && detail ? g_intern_string (detail) : detail;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GRand *rand = g_rand_new_with_seed (42);
+  gint   round, i;
+  gint   n_found = 0;
+
+  for (round = 0; round < 50; round++)
+    {
+      ThemeImageIndex *index;
+      GList           *img_list = NULL;
+      gint             n_images = g_rand_int_range (rand, 0, 60);
+
+      for (i = 0; i < n_images; i++)
+        {
+          ThemeImage *image = g_new0 (ThemeImage, 1);
+
+          random_match_data (rand, &image->match_data, TRUE);
+          image->match_data.detail = details[g_rand_int_range (rand, 0, G_N_ELEMENTS (details))];
+          if (image->match_data.detail)
+            image->match_data.detail = g_intern_string (image->match_data.detail);
+          img_list = g_list_prepend (img_list, image);
+        }
+      img_list = g_list_reverse (img_list);
+
+      index = theme_image_index_new (img_list);
+
+      for (i = 0; i < 500; i++)
+        {
+          ThemeMatchData match_data;
+          ThemeImage    *image;
+          gchar         *detail;
+
+          random_match_data (rand, &match_data, FALSE);
+
+          /* the details of the paint calls are not interned */
+          detail = g_strdup (match_data.detail);
+          match_data.detail = detail;
+
+          image = match_linear (img_list, &match_data);
+          g_assert (theme_image_index_match (index, &match_data) == image);
+          if (image)
+            n_found++;
+
+          g_free (detail);
+        }
+
+      /* a detail no gtkrc has */
+      {
+        ThemeMatchData match_data;
+
+        random_match_data (rand, &match_data, FALSE);
+        match_data.detail = "no-such-detail_start";
+        g_assert (theme_image_index_match (index, &match_data) ==
+                  match_linear (img_list, &match_data));
+      }
+
+      theme_image_index_free (index);
+      g_list_foreach (img_list, (GFunc) g_free, NULL);
+      g_list_free (img_list);
+    }
+
+  g_rand_free (rand);
+
+  /* not only misses were compared */
+  g_assert (n_found > 0);
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+#include "snapshot.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+int
+main (int    argc,
+      char **argv)
+{
+  /* 3x2 pixels, with padding at the end of the rows */
+  static const guint32 pixels[2][4] =
+  {
+    { 0xff102030, 0x80402010, 0x00000000, 0xdeadbeef },
+    { 0xffffffff, 0xff000000, 0x01010101, 0xdeadbeef }
+  };
+  SnapshotSlice  slices[2];
+  SnapshotImage  image;
+  SnapshotImage  found;
+  Snapshot      *snapshot;
+  GError        *error = NULL;
+  gchar         *dir;
+  gchar         *png, *path;
+  gint           y;
+
+  dir = g_build_filename (g_get_tmp_dir (), "sapwood-snapshot-XXXXXX", NULL);
+  g_assert (g_mkdtemp (dir));
+  png  = g_build_filename (dir, "image.png", NULL);
+  path = g_build_filename (dir, "snapshot", NULL);
+
+  g_assert (g_file_set_contents (png, "not decoded", -1, NULL));
+
+  memset (&image, 0, sizeof (image));
+  image.filename  = png;
+  image.width     = 3;
+  image.height    = 2;
+  image.stride    = sizeof (pixels[0]);
+  image.has_alpha = TRUE;
+  image.pixels    = (const guchar *) pixels;
+  image.digest    = "0123456789abcdef0123456789abcdef01234567";
+  image.slices    = slices;
+  image.n_slices  = 2;
+
+  memset (slices, 0, sizeof (slices));
+  slices[0].border_left = 1;
+  slices[0].mixed       = 1 << 1;
+  slices[1].border_top  = 1;
+  slices[1].solid       = 1 << 0;
+  slices[1].color[0][0] = 0x102030;
+  g_assert (snapshot_file_stat (png, &image.mtime, &image.file_size));
+
+  g_assert (snapshot_write (path, &image, 1, &error));
+  g_assert (!error);
+
+  snapshot = snapshot_open (path, &error);
+  g_assert (snapshot && !error);
+  g_assert (snapshot_get_n_images (snapshot) == 1);
+
+  g_assert (!snapshot_lookup (snapshot, path, &found));
+  g_assert (snapshot_lookup (snapshot, png, &found));
+  g_assert (!strcmp (found.filename, png));
+  g_assert (found.width == 3 && found.height == 2 && found.has_alpha);
+  g_assert (!strcmp (found.digest, image.digest));
+  /* the rows are stored without the padding, aligned for SSE2 */
+  g_assert (found.stride == 3 * 4);
+  g_assert (GPOINTER_TO_SIZE (found.pixels) % 16 == 0);
+  for (y = 0; y < 2; y++)
+    g_assert (!memcmp (found.pixels + y * found.stride, pixels[y], 3 * 4));
+
+  g_assert (found.n_slices == 2);
+  g_assert (!snapshot_image_find_slice (&found, 0, 0, 0, 0));
+  g_assert (snapshot_image_find_slice (&found, 1, 0, 0, 0)->mixed == 1 << 1);
+  g_assert (snapshot_image_find_slice (&found, 0, 0, 1, 0)->color[0][0] == 0x102030);
+
+  /* changing the file invalidates its image */
+  g_assert (g_file_set_contents (png, "changed, not decoded", -1, NULL));
+  g_assert (!snapshot_lookup (snapshot, png, &found));
+
+  snapshot_unref (snapshot);
+
+  /* files that are not snapshots, or cut short, are refused */
+  g_assert (g_file_set_contents (path, "garbage, not a snapshot", -1, NULL));
+  g_assert (!snapshot_open (path, &error));
+  g_assert (error);
+  g_clear_error (&error);
+
+  g_assert (snapshot_write (path, &image, 1, NULL));
+  g_assert (truncate (path, 100) == 0);
+  g_assert (!snapshot_open (path, &error));
+  g_assert (error);
+  g_clear_error (&error);
+
+  g_unlink (path);
+  g_unlink (png);
+  g_rmdir (dir);
+  g_free (path);
+  g_free (png);
+  g_free (dir);
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+
+#include <config.h>
+
+#include <gdk/gdk.h>
+#include "image-slice.h"
+#include "sapwood-client.h"
+#include "test-open.h"
+
+#define IMAGE TOP_SRCDIR G_DIR_SEPARATOR_S "demos" G_DIR_SEPARATOR_S "images" G_DIR_SEPARATOR_S "gradient.png"
+
+/* opens an image with borders larger than it; the server must slice it
+ * within the image, as image_slice_bounds() does */
+int
+main (int    argc,
+      char **argv)
+{
+  PixbufOpenResponse rep;
+  GError            *error = NULL;
+  gint               width, height;
+  gint               bounds_x[4], bounds_y[4];
+  gint               i, j;
+
+  gdk_init (&argc, &argv);
+
+  g_assert (gdk_pixbuf_get_file_info (IMAGE, &width, &height));
+  g_assert (120 > width && 130 > height);
+
+  if (!test_open_image (IMAGE, 120, 10, 10, 130, &rep, &error))
+    {
+      g_warning ("%s", error->message);
+      g_clear_error (&error);
+      return 1;
+    }
+
+  g_assert (rep.width == width && rep.height == height);
+
+  image_slice_bounds (width, height, 120, 10, 10, 130, bounds_x, bounds_y);
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      {
+        gint part_width  = bounds_x[j + 1] - bounds_x[j];
+        gint part_height = bounds_y[i + 1] - bounds_y[i];
+
+        g_assert (bounds_x[j] >= 0 && bounds_x[j + 1] <= width);
+        g_assert (bounds_y[i] >= 0 && bounds_y[i + 1] <= height);
+
+        if (part_width <= 0 || part_height <= 0)
+          {
+            /* nothing of the image is left for the part */
+            g_assert (!rep.pixmap[i][j] && !rep.pixmask[i][j]);
+            g_assert (!PIXBUF_OPEN_RESPONSE_SOLID (&rep, i, j));
+          }
+        else if (rep.pixmap[i][j] && !rep.atlas_width)
+          {
+            /* only the corners are left, none of them is a strip */
+            g_assert (i != 1 && j != 1);
+            g_assert (rep.tile_width[i][j] == part_width);
+            g_assert (rep.tile_height[i][j] == part_height);
+          }
+      }
+
+  test_close_image (rep.id);
+
+  return 0;
+}
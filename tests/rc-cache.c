@@ -0,0 +1,216 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include <glib/gstdio.h>
+
+#include "sapwood-rc-style.h"
+
+/* parses rc-cache.gtkrc with and without the gtkrc cache and compares the
+ * images it gives, the cache being written by this process and used by
+ * the children it spawns */
+
+static void
+dump_pixbuf (GString     *dump,
+             const gchar *name,
+             ThemePixbuf *theme_pb)
+{
+  if (!theme_pb)
+    return;
+
+  g_string_append_printf (dump, "  %s %s/%s %d,%d,%d,%d%s\n", name,
+                          theme_pb->dirname, theme_pb->basename,
+                          theme_pb->border_left, theme_pb->border_right,
+                          theme_pb->border_top, theme_pb->border_bottom,
+                          theme_pb->stretch ? " stretch" : "");
+}
+
+static gchar *
+parse_theme (const gchar *gtkrc,
+             const gchar *pixmap_path)
+{
+  GtkStyle *style;
+  GString  *dump;
+  GList    *l;
+  gchar    *rc_string;
+
+  rc_string = g_strdup_printf ("pixmap_path \"%s\"", pixmap_path);
+  gtk_rc_parse_string (rc_string);
+  g_free (rc_string);
+  gtk_rc_parse (gtkrc);
+
+  style = gtk_rc_get_style_by_paths (gtk_settings_get_default (),
+                                     NULL, NULL, GTK_TYPE_BUTTON);
+  g_assert (style != NULL);
+  g_assert (G_TYPE_CHECK_INSTANCE_TYPE (style->rc_style,
+                                        g_type_from_name ("SapwoodRcStyle")));
+
+  dump = g_string_new (NULL);
+  for (l = ((SapwoodRcStyle *) style->rc_style)->img_list; l; l = l->next)
+    {
+      ThemeImage     *image = l->data;
+      ThemeMatchData *match = &image->match_data;
+
+      g_string_append_printf (dump, "%d %s flags %d state %d shadow %d "
+                              "gap_side %d arrow %d orientation %d "
+                              "position %d%s\n",
+                              match->function,
+                              match->detail ? match->detail : "(none)",
+                              match->flags, match->state, match->shadow,
+                              match->gap_side, match->arrow_direction,
+                              match->orientation, match->position,
+                              image->background_shaped ? " shaped" : "");
+      dump_pixbuf (dump, "background", image->background);
+      dump_pixbuf (dump, "overlay", image->overlay);
+      dump_pixbuf (dump, "gap_start", image->gap_start);
+      dump_pixbuf (dump, "gap", image->gap);
+      dump_pixbuf (dump, "gap_end", image->gap_end);
+    }
+
+  return g_string_free (dump, FALSE);
+}
+
+static gchar *
+parse_theme_in_child (const gchar *argv0,
+                      const gchar *gtkrc,
+                      const gchar *pixmap_path)
+{
+  gchar  *argv[] = { (gchar *) argv0, "--child", (gchar *) gtkrc,
+                     (gchar *) pixmap_path, NULL };
+  GError *error = NULL;
+  gchar  *dump = NULL;
+  gint    status;
+
+  g_spawn_sync (NULL, argv, NULL, 0, NULL, NULL, &dump, NULL, &status,
+                &error);
+  g_assert_no_error (error);
+  g_assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+  return dump;
+}
+
+int
+main (int   argc,
+      char **argv)
+{
+  GError      *error = NULL;
+  gchar       *srcdir;
+  gchar       *template;
+  gchar       *tmpdir;
+  gchar       *gtkrc;
+  gchar       *images;
+  gchar       *cache_dir;
+  gchar       *copy;
+  gchar       *path;
+  gchar       *pixmap_path;
+  gchar       *contents;
+  gsize        length;
+  gchar       *uncached;
+  gchar       *cached;
+  gchar       *moved;
+  GDir        *dir;
+  const gchar *name;
+
+  if (argc == 4 && !strcmp (argv[1], "--child"))
+    {
+      gchar *dump;
+
+      gtk_init (&argc, &argv);
+      dump = parse_theme (argv[2], argv[3]);
+      fputs (dump, stdout);
+      g_free (dump);
+      return 0;
+    }
+
+  srcdir = realpath (TOP_SRCDIR, NULL);
+  g_assert (srcdir != NULL);
+  gtkrc = g_build_filename (srcdir, "tests", "rc-cache.gtkrc", NULL);
+  images = g_build_filename (srcdir, "demos", "images", NULL);
+
+  /* a cache of our own, inherited by the children */
+  template = g_build_filename (g_get_tmp_dir (), "rc-cache-XXXXXX", NULL);
+  g_assert (mkdtemp (template) != NULL);
+  tmpdir = realpath (template, NULL);
+  g_free (template);
+  g_setenv ("XDG_CACHE_HOME", tmpdir, TRUE);
+
+  gtk_init (&argc, &argv);
+
+  uncached = parse_theme (gtkrc, images);
+  g_assert (strstr (uncached, "/gradient.png 4,4,4,4 stretch\n") != NULL);
+
+  /* the cache is written from an idle */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  cache_dir = g_build_filename (tmpdir, "sapwood", NULL);
+  dir = g_dir_open (cache_dir, 0, &error);
+  g_assert_no_error (error);
+  name = g_dir_read_name (dir);
+  g_assert (name != NULL);
+
+  cached = parse_theme_in_child (argv[0], gtkrc, images);
+  g_assert_cmpstr (cached, ==, uncached);
+
+  /* another pixmap_path finds another gradient.png, the cached block must
+   * not be used */
+  copy = g_build_filename (tmpdir, "gradient.png", NULL);
+  path = g_build_filename (images, "gradient.png", NULL);
+  g_file_get_contents (path, &contents, &length, &error);
+  g_assert_no_error (error);
+  g_free (path);
+  g_file_set_contents (copy, contents, length, &error);
+  g_assert_no_error (error);
+  g_free (contents);
+
+  pixmap_path = g_strconcat (tmpdir, ":", images, NULL);
+  moved = parse_theme_in_child (argv[0], gtkrc, pixmap_path);
+  g_assert_cmpstr (moved, !=, uncached);
+  g_assert (strstr (moved, copy) != NULL);
+
+  do
+    {
+      path = g_build_filename (cache_dir, name, NULL);
+      g_remove (path);
+      g_free (path);
+    }
+  while ((name = g_dir_read_name (dir)));
+  g_dir_close (dir);
+  g_rmdir (cache_dir);
+  g_remove (copy);
+  g_rmdir (tmpdir);
+
+  g_free (moved);
+  g_free (pixmap_path);
+  g_free (copy);
+  g_free (cached);
+  g_free (cache_dir);
+  g_free (uncached);
+  g_free (images);
+  g_free (gtkrc);
+  free (tmpdir);
+  free (srcdir);
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+#include "shelf-packer.h"
+
+int
+main (int    argc,
+      char **argv)
+{
+  ShelfPacker *packer = shelf_packer_new (64, 64);
+  gint         x, y;
+
+  g_assert (shelf_packer_is_empty (packer));
+  g_assert (!shelf_packer_alloc (packer, 65, 1, &x, &y));
+
+  /* shelves are rounded up to multiples of 8 */
+  g_assert (shelf_packer_alloc (packer, 40, 5, &x, &y));
+  g_assert (x == 0 && y == 0);
+  g_assert (shelf_packer_alloc (packer, 24, 8, &x, &y));
+  g_assert (x == 40 && y == 0);
+
+  /* full, a new shelf */
+  g_assert (shelf_packer_alloc (packer, 10, 3, &x, &y));
+  g_assert (x == 0 && y == 8);
+
+  /* too high for the 8 pixel shelves */
+  g_assert (shelf_packer_alloc (packer, 10, 16, &x, &y));
+  g_assert (x == 0 && y == 16);
+  g_assert (shelf_packer_alloc (packer, 10, 9, &x, &y));
+  g_assert (x == 10 && y == 16);
+
+  /* too low for the shelves in use */
+  g_assert (shelf_packer_alloc (packer, 10, 2, &x, &y));
+  g_assert (x == 0 && y == 32);
+
+  /* no room left on top */
+  g_assert (!shelf_packer_alloc (packer, 10, 32, &x, &y));
+
+  /* released space is reused and merged */
+  shelf_packer_release (packer, 0, 0, 40);
+  g_assert (shelf_packer_alloc (packer, 20, 8, &x, &y));
+  g_assert (x == 0 && y == 0);
+  shelf_packer_release (packer, 0, 0, 20);
+  shelf_packer_release (packer, 40, 0, 24);
+  g_assert (shelf_packer_alloc (packer, 64, 7, &x, &y));
+  g_assert (x == 0 && y == 0);
+
+  /* the shelves are removed from the top once they are empty */
+  shelf_packer_release (packer, 0, 0, 64);
+  shelf_packer_release (packer, 0, 8, 10);
+  shelf_packer_release (packer, 10, 16, 10);
+  shelf_packer_release (packer, 0, 16, 10);
+  g_assert (!shelf_packer_is_empty (packer));
+  shelf_packer_release (packer, 0, 32, 10);
+  g_assert (shelf_packer_is_empty (packer));
+
+  shelf_packer_free (packer);
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+
+#include <config.h>
+
+#include <limits.h>
+#include <string.h>
+#include "sapwood-client.h"
+#include "test-open.h"
+
+static void
+open_reply (const char   *reply,
+            gsize         reply_len,
+            const GError *error,
+            gpointer      user_data)
+{
+  PixbufOpenResponse *rep = user_data;
+
+  if (!error && reply_len == sizeof (*rep))
+    memcpy (rep, reply, sizeof (*rep));
+}
+
+gboolean
+test_open_image (const char         *filename,
+                 int                 border_left,
+                 int                 border_right,
+                 int                 border_top,
+                 int                 border_bottom,
+                 PixbufOpenResponse *rep,
+                 GError            **err)
+{
+  char               buf[ sizeof(PixbufOpenRequest) + PATH_MAX + 1 ] = {0};
+  PixbufOpenRequest *req = (PixbufOpenRequest *) buf;
+  int                flen;
+  guint32            seq;
+
+  /* marshal request */
+  flen = g_strlcpy (req->filename, filename, PATH_MAX);
+  if (flen > PATH_MAX)
+    {
+      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		   "%s: filename too long", filename);
+      return FALSE;
+    }
+
+  req->base.op       = PIXBUF_OP_OPEN;
+  req->base.length   = sizeof(*req) + flen + 1;
+  req->border_left   = border_left;
+  req->border_right  = border_right;
+  req->border_top    = border_top;
+  req->border_bottom = border_bottom;
+
+  memset (rep, 0, sizeof (*rep));
+  seq = sapwood_client_request (&req->base, open_reply, rep, err);
+  if (!seq || !sapwood_client_wait (seq, err))
+    return FALSE;
+
+  if (!rep->id)
+    {
+      g_set_error (err, SAPWOOD_CLIENT_ERROR, SAPWOOD_CLIENT_ERROR_UNKNOWN,
+		   "%s: failed to open", filename);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+void
+test_close_image (guint32 id)
+{
+  PixbufCloseRequest  req;
+  GError             *err = NULL;
+
+  req.base.op     = PIXBUF_OP_CLOSE;
+  req.base.length = sizeof(PixbufCloseRequest);
+  req.id          = id;
+  if (!sapwood_client_request (&req.base, NULL, NULL, &err))
+    {
+      g_warning ("close(0x%x): %s", id, err->message);
+      g_error_free (err);
+      return;
+    }
+}
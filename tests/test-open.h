@@ -0,0 +1,44 @@
+/* This file is part of GTK+ Sapwood Engine
+ *
+ * This work is provided "as is"; redistribution and modification
+ * in whole or in part, in any medium, physical or electronic is
+ * permitted without restriction.
+ *
+ * This work is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * In no event shall the authors or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ */
+
+
+#ifndef TEST_OPEN_H
+#define TEST_OPEN_H
+
+#include "sapwood-proto.h"
+
+G_BEGIN_DECLS
+
+/* Sends an open request for @filename with the borders to the server and
+ * waits for its reply, in @rep; fails if the server could not open it. */
+gboolean test_open_image (const char         *filename,
+                          int                 border_left,
+                          int                 border_right,
+                          int                 border_top,
+                          int                 border_bottom,
+                          PixbufOpenResponse *rep,
+                          GError            **err);
+
+/* Closes the image @id of an open reply, without waiting. */
+void     test_close_image (guint32             id);
+
+G_END_DECLS
+
+#endif /* !TEST_OPEN_H */